@@ -0,0 +1,367 @@
+// Benchmark of the indexer binary on a generated tree.
+// Generates a synthetic directory tree in a temporary directory, runs every command of the indexer against it
+// and reports wall time latencies, throughput and database size as JSON, so runs of different versions can be compared.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace po = boost::program_options;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+extern char **environ;
+
+// shape of the generated tree
+struct tree_shape{
+    std::size_t m_files = 100000;
+    unsigned m_depth = 3;
+    unsigned m_fanout = 10;
+    long long m_max_size = 1024 * 1024;
+    // extension and its weight, an empty extension is a file without one
+    vector<std::pair<string, unsigned>> m_extensions;
+    unsigned m_seed = 1;
+};
+
+// what was generated
+struct tree_info{
+    string m_root;
+    std::size_t m_files = 0;
+    std::size_t m_directories = 0;
+    long long m_bytes = 0;
+    vector<string> m_file_paths;
+    vector<string> m_directory_paths;
+};
+
+// latencies of one benchmarked operation
+struct bench_result{
+    string m_name;
+    vector<double> m_ms;
+    // files handled per run, 0 if throughput makes no sense for the operation
+    std::size_t m_files = 0;
+};
+
+static bool parse_extensions(const string& text, vector<std::pair<string, unsigned>>& extensions){
+    std::istringstream in(text);
+    string item;
+    while(std::getline(in, item, ',')){
+        auto colon = item.rfind(':');
+        if(colon == string::npos){
+            return false;
+        }
+        try{
+            extensions.emplace_back(item.substr(0, colon), static_cast<unsigned>(std::stoul(item.substr(colon + 1))));
+        } catch (const std::exception&){
+            return false;
+        }
+    }
+    return !extensions.empty();
+}
+
+// Directories form a full tree of `depth` levels with `fanout` children each, files are spread over all of them.
+// Sizes are log-uniform up to the max size, files are sparse so generating a large tree writes no data.
+static bool generate_tree(const tree_shape& shape, tree_info& tree){
+    std::mt19937_64 rng(shape.m_seed);
+    tree.m_directory_paths.push_back(tree.m_root);
+    std::size_t level_begin = 0;
+    for (unsigned level = 0; level < shape.m_depth; ++level) {
+        const std::size_t level_end = tree.m_directory_paths.size();
+        for (std::size_t i = level_begin; i < level_end; ++i) {
+            for (unsigned child = 0; child < shape.m_fanout; ++child) {
+                string path = tree.m_directory_paths[i] + "/d" + std::to_string(child);
+                if(mkdir(path.c_str(), 0755) == -1){
+                    cerr << "cannot create " << path << ": " << strerror(errno) << endl;
+                    return false;
+                }
+                tree.m_directory_paths.push_back(std::move(path));
+            }
+        }
+        level_begin = level_end;
+    }
+    tree.m_directories = tree.m_directory_paths.size();
+
+    vector<unsigned> weights;
+    for (const auto &extension : shape.m_extensions) {
+        weights.push_back(extension.second);
+    }
+    std::discrete_distribution<std::size_t> pick_extension(weights.begin(), weights.end());
+    std::uniform_real_distribution<double> pick_log_size(0.0, std::log2(static_cast<double>(shape.m_max_size) + 1));
+    std::uniform_int_distribution<std::size_t> pick_directory(0, tree.m_directory_paths.size() - 1);
+    // mtimes spread over the last year, so time ranges select part of the tree
+    const auto now = static_cast<long long>(time(nullptr));
+    std::uniform_int_distribution<long long> pick_mtime(now - 365LL * 24 * 3600, now);
+
+    for (std::size_t i = 0; i < shape.m_files; ++i) {
+        const auto &directory = tree.m_directory_paths[pick_directory(rng)];
+        string path = directory + "/file_" + std::to_string(i) + shape.m_extensions[pick_extension(rng)].first;
+        const auto size = static_cast<long long>(std::exp2(pick_log_size(rng))) - 1;
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if(fd == -1 || ftruncate(fd, size) == -1){
+            cerr << "cannot create " << path << ": " << strerror(errno) << endl;
+            if(fd != -1){
+                close(fd);
+            }
+            return false;
+        }
+        timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = pick_mtime(rng);
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        futimens(fd, times);
+        close(fd);
+        tree.m_bytes += size;
+        tree.m_file_paths.push_back(std::move(path));
+    }
+    tree.m_files = shape.m_files;
+    return true;
+}
+
+// runs the indexer with its output discarded, returns wall time in milliseconds or a negative value on failure
+static double run_timed(const string& binary, const vector<string>& args){
+    vector<char*> argv;
+    argv.push_back(const_cast<char*>(binary.c_str()));
+    for (const auto &arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    const auto started = std::chrono::steady_clock::now();
+    pid_t pid;
+    int err = posix_spawn(&pid, binary.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(err != 0){
+        cerr << "cannot run " << binary << ": " << strerror(err) << endl;
+        return -1;
+    }
+    int status;
+    while(waitpid(pid, &status, 0) == -1 && errno == EINTR){}
+    const auto elapsed = std::chrono::steady_clock::now() - started;
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        cerr << "command failed:";
+        for (const auto &arg : args) {
+            cerr << " " << arg;
+        }
+        cerr << endl;
+        return -1;
+    }
+    return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+// nearest rank percentile
+static double percentile(vector<double> values, double p){
+    if(values.empty()){
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    auto rank = static_cast<std::size_t>(std::ceil(p / 100.0 * static_cast<double>(values.size())));
+    return values[std::max<std::size_t>(rank, 1) - 1];
+}
+
+static string json_escape(const string& text){
+    string result;
+    for (char c : text) {
+        switch (c) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20){
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    result += buffer;
+                } else{
+                    result += c;
+                }
+        }
+    }
+    return result;
+}
+
+static long long file_size(const string& path){
+    struct stat sb;
+    return stat(path.c_str(), &sb) == 0 ? static_cast<long long>(sb.st_size) : 0;
+}
+
+static void write_json(std::ostream& out, const tree_shape& shape, const tree_info& tree,
+                       const vector<bench_result>& results, long long db_size){
+    out << "{\n";
+    out << "  \"tree\": {\"files\": " << tree.m_files << ", \"directories\": " << tree.m_directories
+        << ", \"bytes\": " << tree.m_bytes << ", \"depth\": " << shape.m_depth << ", \"fanout\": " << shape.m_fanout
+        << ", \"seed\": " << shape.m_seed << "},\n";
+    out << "  \"db_size_bytes\": " << db_size << ",\n";
+    out << "  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const auto &result = results[i];
+        const double p50 = percentile(result.m_ms, 50);
+        out << "    {\"name\": \"" << json_escape(result.m_name) << "\", \"runs\": " << result.m_ms.size()
+            << ", \"p50_ms\": " << p50 << ", \"p99_ms\": " << percentile(result.m_ms, 99);
+        if(result.m_files != 0 && p50 > 0){
+            out << ", \"files_per_sec\": " << static_cast<long long>(static_cast<double>(result.m_files) / (p50 / 1000.0));
+        }
+        out << "}" << (i + 1 == results.size() ? "" : ",") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+int main(int argc, char **argv){
+    tree_shape shape;
+    string binary, output, extensions, work_dir;
+    unsigned repeat, jobs;
+    double stale_percent;
+    bool keep;
+
+    po::options_description desc("Benchmark options");
+    desc.add_options()
+            ("help", "produce this help message")
+            ("binary", po::value<string>(&binary)->required(), "indexer binary to benchmark")
+            ("output,o", po::value<string>(&output), "write the JSON report to this file instead of stdout")
+            ("files", po::value<std::size_t>(&shape.m_files)->default_value(shape.m_files), "number of generated files")
+            ("depth", po::value<unsigned>(&shape.m_depth)->default_value(shape.m_depth), "levels of directories")
+            ("fanout", po::value<unsigned>(&shape.m_fanout)->default_value(shape.m_fanout),
+             "subdirectories of every directory")
+            ("max-size", po::value<long long>(&shape.m_max_size)->default_value(shape.m_max_size),
+             "max file size in bytes, sizes are log-uniform and files are sparse")
+            ("extensions", po::value<string>(&extensions)->default_value(".c:30,.h:20,.txt:20,.o:15,.md:10,:5"),
+             "extensions and their weights, an empty extension is a file without one")
+            ("seed", po::value<unsigned>(&shape.m_seed)->default_value(shape.m_seed), "random seed of the generator")
+            ("repeat", po::value<unsigned>(&repeat)->default_value(20), "runs of every search and stat operation")
+            ("stale-percent", po::value<double>(&stale_percent)->default_value(10),
+             "percent of files deleted before the stale cleanup run")
+            ("jobs,j", po::value<unsigned>(&jobs)->default_value(1), "walker threads passed to the indexer")
+            ("work-dir", po::value<string>(&work_dir)->default_value("/tmp"), "where the temporary tree is created")
+            ("keep", po::bool_switch(&keep)->default_value(false), "keep the generated tree and database");
+
+    po::variables_map vm;
+    try{
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if(vm.count("help")){
+            std::cout << desc << endl;
+            return EXIT_SUCCESS;
+        }
+        po::notify(vm);
+    } catch (const std::exception& err){
+        cerr << err.what() << endl << desc << endl;
+        return EXIT_FAILURE;
+    }
+    if(!parse_extensions(extensions, shape.m_extensions) || shape.m_fanout == 0){
+        cerr << "invalid tree shape" << endl;
+        return EXIT_FAILURE;
+    }
+    char resolved[PATH_MAX];
+    if(realpath(binary.c_str(), resolved) == nullptr){
+        cerr << "invalid binary: " << binary << endl;
+        return EXIT_FAILURE;
+    }
+    binary = resolved;
+
+    string temp = work_dir + "/ocw-bench-XXXXXX";
+    if(mkdtemp(&temp[0]) == nullptr){
+        cerr << "cannot create temporary directory: " << strerror(errno) << endl;
+        return EXIT_FAILURE;
+    }
+    tree_info tree;
+    tree.m_root = temp + "/tree";
+    const string db = temp + "/index.sqlite";
+    if(mkdir(tree.m_root.c_str(), 0755) == -1 || !generate_tree(shape, tree)){
+        return EXIT_FAILURE;
+    }
+    cerr << "generated " << tree.m_files << " files in " << tree.m_directories << " directories under " << temp << endl;
+
+    const string jobs_arg = "--jobs=" + std::to_string(jobs);
+    vector<bench_result> results;
+    bool ok = true;
+    auto measure = [&](const string& name, const vector<string>& args, unsigned runs, std::size_t files){
+        bench_result result;
+        result.m_name = name;
+        result.m_files = files;
+        for (unsigned i = 0; i < runs && ok; ++i) {
+            double ms = run_timed(binary, args);
+            if(ms < 0){
+                ok = false;
+                break;
+            }
+            result.m_ms.push_back(ms);
+        }
+        cerr << name << ": " << percentile(result.m_ms, 50) << " ms" << endl;
+        results.push_back(std::move(result));
+    };
+
+    const vector<string> index_args{"index", tree.m_root, "-d", db, jobs_arg};
+    vector<string> incremental_args = index_args;
+    incremental_args.emplace_back("--incremental");
+    measure("cold_index", index_args, 1, tree.m_files);
+    measure("warm_reindex", index_args, 1, tree.m_files);
+    measure("incremental_reindex", incremental_args, 1, tree.m_files);
+    vector<string> io_uring_args = incremental_args;
+    io_uring_args.emplace_back("--io-uring");
+    measure("incremental_reindex_io_uring", io_uring_args, 1, tree.m_files);
+
+    // stale cleanup, a deterministic share of the files is deleted
+    std::size_t deleted = 0;
+    const auto step = stale_percent > 0 ? static_cast<std::size_t>(std::max(1.0, 100.0 / stale_percent)) : 0;
+    for (std::size_t i = 0; step != 0 && i < tree.m_file_paths.size(); i += step) {
+        deleted += unlink(tree.m_file_paths[i].c_str()) == 0;
+    }
+    measure("stale_cleanup", index_args, 1, deleted);
+    measure("stale_cleanup_incremental", incremental_args, 1, 0);
+
+    const string middle_directory = tree.m_directory_paths[std::min<std::size_t>(1, tree.m_directories - 1)];
+    const string db_arg = "--index-database-file=" + db;
+    const string extension = "--target=" + shape.m_extensions.front().first;
+    const vector<std::pair<string, vector<string>>> queries{
+            {"search_extension", {"search", db_arg, "--by=extension", extension}},
+            {"search_directory", {"search", db_arg, "--by=directory", "--target=" + middle_directory}},
+            {"search_directory_recursive", {"search", db_arg, "--by=directory", "-r", "--target=" + middle_directory}},
+            {"search_name_substring", {"search", db_arg, "--by=name", "--target=file_12"}},
+            {"search_name_glob", {"search", db_arg, "--by=name", "--target=file_1*5.c"}},
+            {"search_name_regex", {"search", db_arg, "--by=name", "--regex", "--target=^file_1[0-9]5\\.c$"}},
+            {"search_size", {"search", db_arg, "--by=size", "--min=512K"}},
+            {"search_changed", {"search", db_arg, "--by=changed", "--changed-after=@" + std::to_string(time(nullptr) - 7 * 24 * 3600)}},
+            {"stat_extension", {"stat", db_arg}},
+            {"stat_directory", {"stat", db_arg, "--by=directory"}},
+    };
+    for (const auto &query : queries) {
+        measure(query.first, query.second, repeat, 0);
+    }
+
+    const long long db_size = file_size(db) + file_size(db + "-wal");
+    if(output.empty()){
+        write_json(std::cout, shape, tree, results, db_size);
+    } else{
+        std::ofstream out(output);
+        write_json(out, shape, tree, results, db_size);
+    }
+
+    if(!keep){
+        std::error_code err;
+        std::filesystem::remove_all(temp, err);
+        if(err){
+            cerr << "cannot remove " << temp << ": " << err.message() << endl;
+        }
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,208 @@
+#include "content_hash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <boost/log/trivial.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const std::size_t hash_read_size = 1024 * 1024;
+// page aligned, reads copy whole pages out of the page cache
+static const std::size_t hash_buffer_alignment = 4096;
+
+static const std::uint64_t prime64_1 = 0x9E3779B185EBCA87ULL;
+static const std::uint64_t prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const std::uint64_t prime64_3 = 0x165667B19E3779F9ULL;
+static const std::uint64_t prime64_4 = 0x85EBCA77C2B2AE63ULL;
+static const std::uint64_t prime64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline std::uint64_t rotl64(std::uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+// the hash is defined over little-endian words, like every target of this project
+static inline std::uint64_t read64(const unsigned char* p){
+    std::uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline std::uint32_t read32(const unsigned char* p){
+    std::uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline std::uint64_t xxh64_round(std::uint64_t acc, std::uint64_t input){
+    acc += input * prime64_2;
+    acc = rotl64(acc, 31);
+    return acc * prime64_1;
+}
+
+static inline std::uint64_t xxh64_merge_round(std::uint64_t acc, std::uint64_t value){
+    acc ^= xxh64_round(0, value);
+    return acc * prime64_1 + prime64_4;
+}
+
+xxh64::xxh64(std::uint64_t seed): m_v1(seed + prime64_1 + prime64_2), m_v2(seed + prime64_2),
+                                  m_v3(seed), m_v4(seed - prime64_1), m_seed(seed){}
+
+void xxh64::update(const void* data, std::size_t size){
+    const auto *p = static_cast<const unsigned char*>(data);
+    const unsigned char *end = p + size;
+    m_total_size += size;
+
+    if(m_buffered + size < sizeof(m_buffer)){
+        std::memcpy(m_buffer + m_buffered, p, size);
+        m_buffered += size;
+        return;
+    }
+    if(m_buffered != 0){
+        const std::size_t fill = sizeof(m_buffer) - m_buffered;
+        std::memcpy(m_buffer + m_buffered, p, fill);
+        m_v1 = xxh64_round(m_v1, read64(m_buffer));
+        m_v2 = xxh64_round(m_v2, read64(m_buffer + 8));
+        m_v3 = xxh64_round(m_v3, read64(m_buffer + 16));
+        m_v4 = xxh64_round(m_v4, read64(m_buffer + 24));
+        p += fill;
+        m_buffered = 0;
+    }
+    // four independent lanes, the hot loop of the hash
+    std::uint64_t v1 = m_v1, v2 = m_v2, v3 = m_v3, v4 = m_v4;
+    while(end - p >= 32){
+        v1 = xxh64_round(v1, read64(p));
+        v2 = xxh64_round(v2, read64(p + 8));
+        v3 = xxh64_round(v3, read64(p + 16));
+        v4 = xxh64_round(v4, read64(p + 24));
+        p += 32;
+    }
+    m_v1 = v1;
+    m_v2 = v2;
+    m_v3 = v3;
+    m_v4 = v4;
+    if(p < end){
+        m_buffered = static_cast<std::size_t>(end - p);
+        std::memcpy(m_buffer, p, m_buffered);
+    }
+}
+
+std::uint64_t xxh64::digest() const{
+    std::uint64_t h;
+    if(m_total_size >= 32){
+        h = rotl64(m_v1, 1) + rotl64(m_v2, 7) + rotl64(m_v3, 12) + rotl64(m_v4, 18);
+        h = xxh64_merge_round(h, m_v1);
+        h = xxh64_merge_round(h, m_v2);
+        h = xxh64_merge_round(h, m_v3);
+        h = xxh64_merge_round(h, m_v4);
+    } else{
+        h = m_seed + prime64_5;
+    }
+    h += m_total_size;
+
+    const unsigned char *p = m_buffer;
+    const unsigned char *end = m_buffer + m_buffered;
+    while(end - p >= 8){
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * prime64_1 + prime64_4;
+        p += 8;
+    }
+    if(end - p >= 4){
+        h ^= static_cast<std::uint64_t>(read32(p)) * prime64_1;
+        h = rotl64(h, 23) * prime64_2 + prime64_3;
+        p += 4;
+    }
+    while(p < end){
+        h ^= (*p) * prime64_5;
+        h = rotl64(h, 11) * prime64_1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= prime64_2;
+    h ^= h >> 29;
+    h *= prime64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+namespace {
+    struct aligned_free{
+        void operator()(unsigned char* p) const { free(p); }
+    };
+}
+
+bool hash_fd(int fd, std::uint64_t limit, std::uint64_t& hash){
+    // one buffer per thread, allocated on the first file it hashes
+    thread_local std::unique_ptr<unsigned char, aligned_free> buffer;
+    if(!buffer){
+        void *memory = nullptr;
+        if(posix_memalign(&memory, hash_buffer_alignment, hash_read_size) != 0){
+            return false;
+        }
+        buffer.reset(static_cast<unsigned char*>(memory));
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    xxh64 state;
+    std::uint64_t offset = 0;
+    while(offset < limit){
+        const auto wanted = static_cast<std::size_t>(std::min<std::uint64_t>(hash_read_size, limit - offset));
+        ssize_t read_bytes = pread(fd, buffer.get(), wanted, static_cast<off_t>(offset));
+        if(read_bytes == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        if(read_bytes == 0){
+            break;
+        }
+        state.update(buffer.get(), static_cast<std::size_t>(read_bytes));
+        offset += static_cast<std::uint64_t>(read_bytes);
+    }
+    hash = state.digest();
+    return true;
+}
+
+bool hash_file_at(int dir_fd, const char* name, std::uint64_t limit, std::uint64_t& hash, struct stat& sb){
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    if(fd == -1){
+        BOOST_LOG_TRIVIAL(debug) << "cannot open " << name << " for hashing: " << strerror(errno);
+        return false;
+    }
+    // fifos and devices would block or never end
+    bool ok = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && hash_fd(fd, limit, hash);
+    if(ok){
+        struct stat after;
+        // a file written while it was read has no meaningful hash
+        ok = fstat(fd, &after) == 0 && after.st_size == sb.st_size &&
+             after.st_mtim.tv_sec == sb.st_mtim.tv_sec && after.st_mtim.tv_nsec == sb.st_mtim.tv_nsec;
+    }
+    close(fd);
+    return ok;
+}
+
+void hash_files(std::vector<hash_job>& jobs, unsigned threads){
+    std::atomic<std::size_t> next{0};
+    auto worker = [&jobs, &next]{
+        for (std::size_t i = next++; i < jobs.size(); i = next++) {
+            auto &job = jobs[i];
+            job.m_ok = hash_file_at(AT_FDCWD, job.m_path.c_str(), job.m_limit, job.m_hash, job.m_stat);
+        }
+    };
+    threads = std::max(1u, std::min<unsigned>(threads, static_cast<unsigned>(jobs.size())));
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef OS_COURSE_WORK_CONTENT_HASH_H
+#define OS_COURSE_WORK_CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+// bytes read for the head hash used to split same-size files before they are read in full,
+// the head hash of a file not larger than this is its full hash
+static const std::uint64_t head_hash_bytes = 64 * 1024;
+
+// Streaming XXH64, a fast non-cryptographic 64-bit hash.
+// Input may come in chunks of any size, the digest equals the one of the whole input at once.
+class xxh64{
+public:
+    explicit xxh64(std::uint64_t seed = 0);
+
+    void update(const void* data, std::size_t size);
+    std::uint64_t digest() const;
+
+private:
+    std::uint64_t m_v1, m_v2, m_v3, m_v4;
+    std::uint64_t m_seed;
+    std::uint64_t m_total_size = 0;
+    unsigned char m_buffer[32];
+    std::size_t m_buffered = 0;
+};
+
+// Hashes at most `limit` bytes of an open file with large sequential reads, the descriptor is not closed.
+// The file must not change while it is read, callers compare size and mtime before and after.
+bool hash_fd(int fd, std::uint64_t limit, std::uint64_t& hash);
+// opens a regular file relative to `dir_fd` (AT_FDCWD for a path) and hashes it, `sb` gets its stat after reading
+bool hash_file_at(int dir_fd, const char* name, std::uint64_t limit, std::uint64_t& hash, struct stat& sb);
+
+// one file hashed by hash_files
+struct hash_job{
+    std::string m_path;
+    std::uint64_t m_limit = UINT64_MAX;
+    std::uint64_t m_hash = 0;
+    struct stat m_stat{};
+    bool m_ok = false;
+};
+
+// hashes all jobs on `threads` threads
+void hash_files(std::vector<hash_job>& jobs, unsigned threads);
+
+#endif //OS_COURSE_WORK_CONTENT_HASH_H
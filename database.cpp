@@ -0,0 +1,255 @@
+#include "database.h"
+
+#include <boost/log/trivial.hpp>
+
+using namespace soci;
+using std::string;
+using std::vector;
+
+const vector<string> create_database_queries = {"CREATE TABLE IF NOT EXISTS `extensions` ("
+                                            "    `id` INTEGER PRIMARY KEY AUTOINCREMENT,"
+                                            "    `extension` TEXT NOT NULL UNIQUE"
+                                            ");",
+                                            "CREATE TABLE IF NOT EXISTS `files`("
+                                            "    `id` INTEGER PRIMARY KEY AUTOINCREMENT,"
+                                            "    `directory` TEXT NOT NULL,"
+                                            "    `filename` TEXT NOT NULL,"
+                                            "    `file_size` INTEGER NOT NULL DEFAULT 0,"
+                                            "    `last_changed_at` TEXT NOT NULL," // this is a datetime
+                                            "    `extension_id` INTEGER NOT NULL,"
+                                            "    foreign key (`extension_id`) REFERENCES `extensions`(`id`)"
+                                            " ON DELETE CASCADE ON UPDATE CASCADE"
+                                            ");"};
+
+const vector<vector<string>> schema_migrations = {
+        // 0 -> 1: every scan gets a generation number, rows seen by a scan are stamped with it
+        {"CREATE TABLE IF NOT EXISTS `scans`("
+         "    `id` INTEGER PRIMARY KEY AUTOINCREMENT,"
+         "    `started_at` TEXT NOT NULL"
+         ");",
+         "ALTER TABLE `files` ADD COLUMN `scan_generation` INTEGER NOT NULL DEFAULT 0;"},
+        // 1 -> 2: directory paths move to their own table, files get lookup indexes
+        {"CREATE TABLE IF NOT EXISTS `directories`("
+         "    `id` INTEGER PRIMARY KEY AUTOINCREMENT,"
+         "    `parent_id` INTEGER,"
+         "    `path` TEXT NOT NULL UNIQUE,"
+         "    foreign key (`parent_id`) REFERENCES `directories`(`id`)"
+         " ON DELETE CASCADE ON UPDATE CASCADE"
+         ");",
+         // every directory of a file and all its ancestors, rtrim() strips the last path component
+         "INSERT INTO `directories`(path) "
+         "WITH RECURSIVE ancestors(path) AS ("
+         "    SELECT DISTINCT directory FROM `files`"
+         "    UNION"
+         "    SELECT CASE WHEN rtrim(path, replace(path, '/', '')) = '/' THEN '/'"
+         "        ELSE substr(path, 1, length(rtrim(path, replace(path, '/', ''))) - 1) END"
+         "    FROM ancestors WHERE path <> '/'"
+         ") SELECT path FROM ancestors ORDER BY path;",
+         "UPDATE `directories` SET parent_id = ("
+         "    SELECT p.id FROM `directories` p WHERE p.path = CASE"
+         "        WHEN rtrim(directories.path, replace(directories.path, '/', '')) = '/' THEN '/'"
+         "        ELSE substr(directories.path, 1, length(rtrim(directories.path, replace(directories.path, '/', ''))) - 1) END"
+         ") WHERE path <> '/';",
+         "CREATE TABLE `files_new`("
+         "    `id` INTEGER PRIMARY KEY AUTOINCREMENT,"
+         "    `directory_id` INTEGER NOT NULL,"
+         "    `filename` TEXT NOT NULL,"
+         "    `file_size` INTEGER NOT NULL DEFAULT 0,"
+         "    `last_changed_at` TEXT NOT NULL," // this is a datetime
+         "    `extension_id` INTEGER NOT NULL,"
+         "    `scan_generation` INTEGER NOT NULL DEFAULT 0,"
+         "    foreign key (`directory_id`) REFERENCES `directories`(`id`)"
+         " ON DELETE CASCADE ON UPDATE CASCADE,"
+         "    foreign key (`extension_id`) REFERENCES `extensions`(`id`)"
+         " ON DELETE CASCADE ON UPDATE CASCADE"
+         ");",
+         // older versions could store the same file twice, the latest row wins
+         "INSERT INTO `files_new`(id, directory_id, filename, file_size, last_changed_at, extension_id, scan_generation) "
+         "SELECT f.id, d.id, f.filename, f.file_size, f.last_changed_at, f.extension_id, f.scan_generation "
+         "FROM `files` f INNER JOIN `directories` d ON d.path = f.directory "
+         "WHERE f.id IN (SELECT MAX(id) FROM `files` GROUP BY directory, filename);",
+         "DROP TABLE `files`;",
+         "ALTER TABLE `files_new` RENAME TO `files`;",
+         "CREATE INDEX `directories_parent_idx` ON `directories`(parent_id);",
+         "CREATE UNIQUE INDEX `files_directory_filename_idx` ON `files`(directory_id, filename);",
+         "CREATE INDEX `files_extension_idx` ON `files`(extension_id, file_size);",
+         "CREATE INDEX `files_size_idx` ON `files`(file_size);",
+         "CREATE INDEX `files_changed_idx` ON `files`(last_changed_at);"},
+        // 2 -> 3: trigram index over file names for substring and glob search, deletes and renames are kept in sync
+        // by triggers. FTS5 flushes its pending terms whenever a statement with triggers runs in the transaction,
+        // so an insert trigger would write one tiny segment per file: the writer indexes new names itself,
+        // after all other writes of a batch, and they are flushed once per batch.
+        {"CREATE VIRTUAL TABLE `files_names` USING fts5("
+         "    filename, content='files', content_rowid='id', tokenize='trigram'"
+         ");",
+         "INSERT INTO `files_names`(files_names) VALUES ('rebuild');",
+         "CREATE TRIGGER `files_names_delete` AFTER DELETE ON `files` BEGIN"
+         "    INSERT INTO `files_names`(files_names, rowid, filename) VALUES ('delete', old.id, old.filename);"
+         " END;",
+         "CREATE TRIGGER `files_names_update` AFTER UPDATE OF filename ON `files` BEGIN"
+         "    INSERT INTO `files_names`(files_names, rowid, filename) VALUES ('delete', old.id, old.filename);"
+         "    INSERT INTO `files_names`(rowid, filename) VALUES (new.id, new.filename);"
+         " END;"},
+        // 3 -> 4: modification time is stored as integer nanoseconds since epoch instead of datetime text,
+        // the table is rebuilt since sqlite can not change a column type, indexes and triggers go with it
+        {"CREATE TABLE `files_new`("
+         "    `id` INTEGER PRIMARY KEY AUTOINCREMENT,"
+         "    `directory_id` INTEGER NOT NULL,"
+         "    `filename` TEXT NOT NULL,"
+         "    `file_size` INTEGER NOT NULL DEFAULT 0,"
+         "    `last_changed_at` INTEGER NOT NULL DEFAULT 0," // nanoseconds since epoch
+         "    `extension_id` INTEGER NOT NULL,"
+         "    `scan_generation` INTEGER NOT NULL DEFAULT 0,"
+         "    foreign key (`directory_id`) REFERENCES `directories`(`id`)"
+         " ON DELETE CASCADE ON UPDATE CASCADE,"
+         "    foreign key (`extension_id`) REFERENCES `extensions`(`id`)"
+         " ON DELETE CASCADE ON UPDATE CASCADE"
+         ");",
+         "INSERT INTO `files_new`(id, directory_id, filename, file_size, last_changed_at, extension_id, scan_generation) "
+         "SELECT id, directory_id, filename, file_size, "
+         "CAST(strftime('%s', last_changed_at) AS INTEGER) * 1000000000, extension_id, scan_generation FROM `files`;",
+         "DROP TABLE `files`;",
+         "ALTER TABLE `files_new` RENAME TO `files`;",
+         "CREATE UNIQUE INDEX `files_directory_filename_idx` ON `files`(directory_id, filename);",
+         "CREATE INDEX `files_extension_idx` ON `files`(extension_id, file_size);",
+         "CREATE INDEX `files_size_idx` ON `files`(file_size);",
+         "CREATE INDEX `files_changed_idx` ON `files`(last_changed_at);",
+         "CREATE TRIGGER `files_names_delete` AFTER DELETE ON `files` BEGIN"
+         "    INSERT INTO `files_names`(files_names, rowid, filename) VALUES ('delete', old.id, old.filename);"
+         " END;",
+         "CREATE TRIGGER `files_names_update` AFTER UPDATE OF filename ON `files` BEGIN"
+         "    INSERT INTO `files_names`(files_names, rowid, filename) VALUES ('delete', old.id, old.filename);"
+         "    INSERT INTO `files_names`(rowid, filename) VALUES (new.id, new.filename);"
+         " END;"},
+        // 4 -> 5: XXH64 of the content, NULL until the file is hashed or after it changed.
+        // Duplicates are candidates of the same size, so the hash is indexed after the size.
+        {"ALTER TABLE `files` ADD COLUMN `content_hash` INTEGER;",
+         "DROP INDEX `files_size_idx`;",
+         "CREATE INDEX `files_size_hash_idx` ON `files`(file_size, content_hash);"},
+        // 5 -> 6: per extension and per directory aggregates kept current by triggers, so stat reads no files.
+        // A row is dropped when its last file goes. The biggest file is found by files_size_hash_idx,
+        // so no max is kept here.
+        {"CREATE TABLE `extension_stats`("
+         "    `extension_id` INTEGER PRIMARY KEY,"
+         "    `files_count` INTEGER NOT NULL DEFAULT 0,"
+         "    `total_size` INTEGER NOT NULL DEFAULT 0,"
+         "    foreign key (`extension_id`) REFERENCES `extensions`(`id`)"
+         " ON DELETE CASCADE ON UPDATE CASCADE"
+         ");",
+         "CREATE TABLE `directory_stats`("
+         "    `directory_id` INTEGER PRIMARY KEY,"
+         "    `files_count` INTEGER NOT NULL DEFAULT 0,"
+         "    `total_size` INTEGER NOT NULL DEFAULT 0,"
+         "    foreign key (`directory_id`) REFERENCES `directories`(`id`)"
+         " ON DELETE CASCADE ON UPDATE CASCADE"
+         ");",
+         "INSERT INTO `extension_stats`(extension_id, files_count, total_size) "
+         "SELECT extension_id, COUNT(*), SUM(file_size) FROM `files` GROUP BY extension_id;",
+         "INSERT INTO `directory_stats`(directory_id, files_count, total_size) "
+         "SELECT directory_id, COUNT(*), SUM(file_size) FROM `files` GROUP BY directory_id;",
+         "CREATE TRIGGER `files_stats_insert` AFTER INSERT ON `files` BEGIN"
+         "    INSERT INTO `extension_stats`(extension_id, files_count, total_size)"
+         "    VALUES (new.extension_id, 1, new.file_size)"
+         "    ON CONFLICT(extension_id) DO UPDATE SET files_count = files_count + 1,"
+         "    total_size = total_size + excluded.total_size;"
+         "    INSERT INTO `directory_stats`(directory_id, files_count, total_size)"
+         "    VALUES (new.directory_id, 1, new.file_size)"
+         "    ON CONFLICT(directory_id) DO UPDATE SET files_count = files_count + 1,"
+         "    total_size = total_size + excluded.total_size;"
+         " END;",
+         "CREATE TRIGGER `files_stats_delete` AFTER DELETE ON `files` BEGIN"
+         "    UPDATE `extension_stats` SET files_count = files_count - 1, total_size = total_size - old.file_size"
+         "    WHERE extension_id = old.extension_id;"
+         "    DELETE FROM `extension_stats` WHERE extension_id = old.extension_id AND files_count = 0;"
+         "    UPDATE `directory_stats` SET files_count = files_count - 1, total_size = total_size - old.file_size"
+         "    WHERE directory_id = old.directory_id;"
+         "    DELETE FROM `directory_stats` WHERE directory_id = old.directory_id AND files_count = 0;"
+         " END;",
+         // the writer sets file_size on every update, unchanged sizes are filtered by WHEN
+         "CREATE TRIGGER `files_stats_update` AFTER UPDATE OF file_size, directory_id, extension_id ON `files`"
+         " WHEN old.file_size IS NOT new.file_size OR old.directory_id IS NOT new.directory_id"
+         " OR old.extension_id IS NOT new.extension_id BEGIN"
+         "    UPDATE `extension_stats` SET files_count = files_count - 1, total_size = total_size - old.file_size"
+         "    WHERE extension_id = old.extension_id;"
+         "    DELETE FROM `extension_stats` WHERE extension_id = old.extension_id AND files_count = 0;"
+         "    UPDATE `directory_stats` SET files_count = files_count - 1, total_size = total_size - old.file_size"
+         "    WHERE directory_id = old.directory_id;"
+         "    DELETE FROM `directory_stats` WHERE directory_id = old.directory_id AND files_count = 0;"
+         "    INSERT INTO `extension_stats`(extension_id, files_count, total_size)"
+         "    VALUES (new.extension_id, 1, new.file_size)"
+         "    ON CONFLICT(extension_id) DO UPDATE SET files_count = files_count + 1,"
+         "    total_size = total_size + excluded.total_size;"
+         "    INSERT INTO `directory_stats`(directory_id, files_count, total_size)"
+         "    VALUES (new.directory_id, 1, new.file_size)"
+         "    ON CONFLICT(directory_id) DO UPDATE SET files_count = files_count + 1,"
+         "    total_size = total_size + excluded.total_size;"
+         " END;"},
+        // 6 -> 7: the layout a shard belongs to, one row, empty in a database that is not sharded
+        {"CREATE TABLE `shard_layout`("
+         "    `shard_index` INTEGER NOT NULL,"
+         "    `shard_count` INTEGER NOT NULL,"
+         "    `shard_by` TEXT NOT NULL"
+         ");"},
+};
+
+// temp_store stays DEFAULT, MEMORY made a full re-index about 15% slower
+const vector<database_profile> database_profiles = {
+        {"safe", "FULL", -16 * 1024, 0, "DEFAULT", 4096},
+        {"fast", "NORMAL", -64 * 1024, 256LL * 1024 * 1024, "DEFAULT", 4096},
+};
+
+const database_profile* find_database_profile(const string &name) {
+    for (const auto &profile : database_profiles) {
+        if (profile.m_name == name) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
+
+void configure_database(session &sql, const database_profile &profile, int busy_timeout_ms, bool new_database) {
+    BOOST_LOG_TRIVIAL(info) << "using database profile " << profile.m_name;
+    // set first, switching the journal mode takes a lock as well
+    sql << "PRAGMA busy_timeout = " << busy_timeout_ms << ";";
+    if (new_database) {
+        // the page size is fixed once the first page is written
+        sql << "PRAGMA page_size = " << profile.m_page_size << ";";
+    }
+    string journal_mode;
+    sql << "PRAGMA journal_mode = WAL;", into(journal_mode);
+    if (journal_mode != "wal") {
+        BOOST_LOG_TRIVIAL(warning) << "database stays in journal mode " << journal_mode;
+    }
+    sql << "PRAGMA synchronous = " << profile.m_synchronous << ";";
+    sql << "PRAGMA cache_size = " << profile.m_cache_size << ";";
+    sql << "PRAGMA mmap_size = " << profile.m_mmap_size << ";";
+    sql << "PRAGMA temp_store = " << profile.m_temp_store << ";";
+}
+
+void create_database(session &sql) {
+    for (const auto &query : create_database_queries) {
+        BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
+        sql << "BEGIN TRANSACTION;";
+        BOOST_LOG_TRIVIAL(trace) << "executing query: " << query;
+        sql << query;
+        BOOST_LOG_TRIVIAL(debug) << "committing transaction";
+        sql << "COMMIT";
+    }
+}
+
+void migrate_database(session &sql) {
+    int version = 0;
+    sql << "PRAGMA user_version;", into(version);
+    for (std::size_t i = version; i < schema_migrations.size(); ++i) {
+        BOOST_LOG_TRIVIAL(info) << "migrating database schema to version " << i + 1;
+        BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
+        sql << "BEGIN TRANSACTION;";
+        for (const auto &query : schema_migrations[i]) {
+            BOOST_LOG_TRIVIAL(trace) << "executing query: " << query;
+            sql << query;
+        }
+        sql << "PRAGMA user_version = " << i + 1 << ";";
+        BOOST_LOG_TRIVIAL(debug) << "committing transaction";
+        sql << "COMMIT";
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef OS_COURSE_WORK_DATABASE_H
+#define OS_COURSE_WORK_DATABASE_H
+
+#include <string>
+#include <vector>
+
+#include <soci/soci.h>
+
+// initial schema, created once for a new database file
+extern const std::vector<std::string> create_database_queries;
+// schema_migrations[i] moves the schema from version i to version i + 1 (PRAGMA user_version)
+extern const std::vector<std::vector<std::string>> schema_migrations;
+
+// connection settings applied at open, see database_profiles
+struct database_profile{
+    std::string m_name;
+    std::string m_synchronous;
+    // negative values are KiB like PRAGMA cache_size
+    long m_cache_size;
+    long long m_mmap_size;
+    std::string m_temp_store;
+    // only takes effect for a new database file
+    long m_page_size;
+};
+
+// "safe" keeps every committed batch on power loss, "fast" may lose the last batches but never corrupts
+extern const std::vector<database_profile> database_profiles;
+
+const database_profile* find_database_profile(const std::string &name);
+// switches to WAL, so readers run concurrently with a writer, and applies the profile;
+// busy_timeout_ms is how long a statement waits for a lock held by another process
+void configure_database(soci::session &sql, const database_profile &profile, int busy_timeout_ms, bool new_database);
+void create_database(soci::session &sql);
+// applies all migrations newer than the database's user_version, each in its own transaction
+void migrate_database(soci::session &sql);
+
+#endif //OS_COURSE_WORK_DATABASE_H
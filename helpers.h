@@ -0,0 +1,172 @@
+#ifndef OS_COURSE_WORK_HELPERS_H
+#define OS_COURSE_WORK_HELPERS_H
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Returns number of days since civil 1970-01-01.  Negative values indicate
+//    days prior to 1970-01-01.
+// Preconditions:  y-m-d represents a date in the civil (Gregorian) calendar
+//                 m is in [1, 12]
+//                 d is in [1, last_day_of_month(y, m)]
+//                 y is "approximately" in
+//                   [numeric_limits<Int>::min()/366, numeric_limits<Int>::max()/366]
+//                 Exact range of validity is:
+//                 [civil_from_days(numeric_limits<Int>::min()),
+//                  civil_from_days(numeric_limits<Int>::max()-719468)]
+template <class Int>
+constexpr
+Int
+days_from_civil(Int y, unsigned m, unsigned d) noexcept
+{
+    static_assert(std::numeric_limits<unsigned>::digits >= 18,
+                  "This algorithm has not been ported to a 16 bit unsigned integer");
+    static_assert(std::numeric_limits<Int>::digits >= 20,
+                  "This algorithm has not been ported to a 16 bit signed integer");
+    y -= m <= 2;
+    const Int era = (y >= 0 ? y : y-399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);      // [0, 399]
+    const unsigned doy = (153*(m + (m > 2 ? -3 : 9)) + 2)/5 + d-1;  // [0, 365]
+    const unsigned doe = yoe * 365 + yoe/4 - yoe/100 + doy;         // [0, 146096]
+    return era * 146097 + static_cast<Int>(doe) - 719468;
+}
+
+// rows printed by stat
+static const int stat_ext_sql_limit = 10;
+static const std::size_t stat_directory_limit = 10;
+
+// nanoseconds since epoch, this is how modification times are stored
+inline
+long long
+timespec_to_ns(const timespec& ts)
+{
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// the extension like std::filesystem::path::extension() finds it, without building a path
+inline
+std::string_view
+file_extension(std::string_view name)
+{
+    const auto dot = name.rfind('.');
+    if (dot == std::string_view::npos || dot == 0 || name == "..")
+        return {};
+    return name.substr(dot);
+}
+
+// Parses a size like "4096", "512K", "1.5G" or "10GiB", suffixes are powers of 1024.
+inline
+bool
+parse_size(const std::string& text, long long& bytes)
+{
+    std::size_t pos = 0;
+    double value;
+    try {
+        value = std::stod(text, &pos);
+    } catch (const std::exception&) {
+        return false;
+    }
+    std::string suffix = text.substr(pos);
+    for (auto &c : suffix)
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    double multiplier = 1;
+    if (!suffix.empty() && suffix != "B") {
+        if (suffix.size() == 3 && suffix.compare(1, 2, "IB") == 0)
+            suffix.resize(1);
+        else if (suffix.size() == 2 && suffix[1] == 'B')
+            suffix.resize(1);
+        const auto unit = std::string("KMGTP").find(suffix);
+        if (suffix.size() != 1 || unit == std::string::npos)
+            return false;
+        for (std::size_t i = 0; i <= unit; ++i)
+            multiplier *= 1024;
+    }
+    // inf, nan and sizes past long long can not be converted
+    const double size = value * multiplier;
+    if (!std::isfinite(size) || size < 0 || size >= 9223372036854775808.0)
+        return false;
+    bytes = static_cast<long long>(size);
+    return true;
+}
+
+// Parses "YYYY-MM-DD", "YYYY-MM-DD HH:MM", "YYYY-MM-DD HH:MM:SS" (UTC, 'T' separator is accepted too)
+// or "@seconds" since epoch into nanoseconds since epoch.
+inline
+bool
+parse_datetime(const std::string& text, long long& ns)
+{
+    if (!text.empty() && text[0] == '@') {
+        try {
+            std::size_t pos = 0;
+            long long seconds = std::stoll(text.substr(1), &pos);
+            if (pos + 1 != text.size())
+                return false;
+            if (seconds > std::numeric_limits<long long>::max() / 1000000000LL ||
+                seconds < std::numeric_limits<long long>::min() / 1000000000LL)
+                return false;
+            ns = seconds * 1000000000LL;
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    int year, month, day, hour = 0, minute = 0, second = 0, consumed = 0;
+    char separator = ' ';
+    int fields = std::sscanf(text.c_str(), "%4d-%2d-%2d%n%c%2d:%2d%n:%2d%n",
+                             &year, &month, &day, &consumed, &separator, &hour, &minute, &consumed, &second, &consumed);
+    if (fields < 3 || static_cast<std::size_t>(consumed) != text.size())
+        return false;
+    if ((fields > 3 && separator != ' ' && separator != 'T') || month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60)
+        return false;
+    long long days = days_from_civil<long long>(year, month, day);
+    ns = ((days * 24 + hour) * 60 + minute) * 60 + second;
+    ns *= 1000000000LL;
+    return true;
+}
+
+// Bounds [first, second) of the directory strings that lie strictly under `directory`,
+// so that a subtree is `d = directory OR (d >= first AND d < second)`, which is a range scan.
+inline
+std::pair<std::string, std::string>
+subtree_bounds(const std::string& directory)
+{
+    std::string prefix = directory == "/" ? directory : directory + "/";
+    std::string upper = prefix;
+    upper.back() = '/' + 1;
+    return {prefix, upper};
+}
+
+// path of file `name` in `directory`, files in "/" get no second slash
+inline
+std::string
+join_path(std::string_view directory, std::string_view name)
+{
+    std::string path(directory);
+    if (directory != "/")
+        path += '/';
+    path += name;
+    return path;
+}
+
+// number of components in an absolute path, "/" has none
+inline
+int
+path_depth(const std::string& path)
+{
+    if (path == "/")
+        return 0;
+    int depth = 0;
+    for (char c : path)
+        depth += c == '/';
+    return depth;
+}
+
+#endif //OS_COURSE_WORK_HELPERS_H
@@ -0,0 +1,105 @@
+#include "index_state.h"
+#include "index_writer.h"
+#include "helpers.h"
+
+#include <filesystem>
+
+#include <boost/log/trivial.hpp>
+
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+using namespace soci;
+using std::string;
+using std::string_view;
+using std::vector;
+
+// the key is built in `buffer`, lookups reuse one buffer per thread instead of allocating a key per file
+static string_view make_key(string_view directory, string_view filename, string& buffer){
+    buffer.assign(directory.data(), directory.size());
+    buffer += '/';
+    buffer.append(filename.data(), filename.size());
+    return buffer;
+}
+
+static thread_local string lookup_key;
+
+void index_state::load(session& sql, const vector<string>& roots, unsigned shard){
+    int id;
+    string directory, filename, key;
+    long long size;
+    long long last_changed;
+    long long content_hash;
+    indicator hash_indicator;
+    for (const auto &root : roots) {
+        struct stat sb;
+        bool is_directory = stat(root.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
+        BOOST_LOG_TRIVIAL(debug) << "loading index state under " << root;
+
+        // bound by reference, must outlive the statement
+        const auto bounds = subtree_bounds(root);
+        const auto cxx_path = fs::path(root);
+        const string parent = cxx_path.parent_path().string(), name = cxx_path.filename().string();
+        statement st(sql);
+        if(is_directory){
+            st = (sql.prepare << "SELECT f.id, d.path, f.filename, f.file_size, f.last_changed_at, f.content_hash FROM `directories` d "
+                                 "INNER JOIN `files` f ON f.directory_id = d.id "
+                                 "WHERE d.path = :dir OR (d.path >= :lower AND d.path < :upper);",
+                    into(id), into(directory), into(filename), into(size), into(last_changed), into(content_hash, hash_indicator),
+                    use(root, "dir"), use(bounds.first, "lower"), use(bounds.second, "upper"));
+        } else{
+            st = (sql.prepare << "SELECT f.id, d.path, f.filename, f.file_size, f.last_changed_at, f.content_hash FROM `directories` d "
+                                 "INNER JOIN `files` f ON f.directory_id = d.id "
+                                 "WHERE d.path = :dir AND f.filename = :name;",
+                    into(id), into(directory), into(filename), into(size), into(last_changed), into(content_hash, hash_indicator),
+                    use(parent, "dir"), use(name, "name"));
+        }
+        st.execute();
+        while(st.fetch()){
+            index_entry entry;
+            entry.m_id = id;
+            entry.m_size = size;
+            entry.m_last_changed = last_changed;
+            entry.m_hashed = hash_indicator == i_ok;
+            entry.m_content_hash = entry.m_hashed ? content_hash : 0;
+            entry.m_shard = shard;
+            m_entries.emplace(m_keys.add(make_key(directory, filename, key)), entry);
+        }
+    }
+    BOOST_LOG_TRIVIAL(info) << "loaded " << m_entries.size() << " indexed files";
+}
+
+index_entry* index_state::find(string_view directory, string_view filename){
+    auto it = m_entries.find(make_key(directory, filename, lookup_key));
+    return it == m_entries.end() ? nullptr : &it->second;
+}
+
+bool index_state::is_unchanged(const index_entry& entry, const file_record& record){
+    return entry.m_size == record.m_size && entry.m_last_changed == timespec_to_ns(record.m_last_changed) &&
+           (entry.m_hashed || !record.m_hashed);
+}
+
+bool index_state::copy_known_hash(file_record& record) const{
+    auto it = m_entries.find(make_key(record.m_directory, record.m_filename, lookup_key));
+    if(it == m_entries.end()){
+        return false;
+    }
+    const auto &entry = it->second;
+    if(!entry.m_hashed || entry.m_size != record.m_size ||
+       entry.m_last_changed != timespec_to_ns(record.m_last_changed)){
+        return false;
+    }
+    record.m_content_hash = entry.m_content_hash;
+    record.m_hashed = true;
+    return true;
+}
+
+vector<int> index_state::unseen_ids(unsigned shard) const{
+    vector<int> ids;
+    for (const auto &item : m_entries) {
+        if(item.second.m_shard == shard && !item.second.m_seen){
+            ids.push_back(item.second.m_id);
+        }
+    }
+    return ids;
+}
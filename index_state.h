@@ -0,0 +1,54 @@
+#ifndef OS_COURSE_WORK_INDEX_STATE_H
+#define OS_COURSE_WORK_INDEX_STATE_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <soci/soci.h>
+
+#include "string_pool.h"
+
+struct file_record;
+
+// what the database knows about one file
+struct index_entry{
+    int m_id = 0;
+    long long m_size = 0;
+    // nanoseconds since epoch
+    long long m_last_changed = 0;
+    long long m_content_hash = 0;
+    bool m_hashed = false;
+    bool m_seen = false;
+    // the database the entry was loaded from
+    unsigned m_shard = 0;
+};
+
+// Snapshot of the indexed files under the walked roots, loaded once before an incremental walk.
+// The walk is diffed against it, so unchanged files cost no query at all
+// and files that disappeared are the entries never seen.
+class index_state{
+public:
+    // loads files under every root, a root that is not a directory loads only itself;
+    // every shard of a sharded index is loaded into the same state
+    void load(soci::session& sql, const std::vector<std::string>& roots, unsigned shard = 0);
+
+    index_entry* find(std::string_view directory, std::string_view filename);
+    // a file that was already hashed is unchanged only if the record carries a hash too
+    static bool is_unchanged(const index_entry& entry, const file_record& record);
+    // Copies the stored hash into the record if the file did not change since it was hashed.
+    // Safe to call from walker threads, the entries are not added or removed after load.
+    bool copy_known_hash(file_record& record) const;
+
+    // ids in `shard`, safe to call while writers of other shards mark their entries as seen
+    std::vector<int> unseen_ids(unsigned shard = 0) const;
+    std::size_t size() const { return m_entries.size(); }
+
+private:
+    // "directory/filename" keys, views into the pool
+    string_pool m_keys;
+    std::unordered_map<std::string_view, index_entry> m_entries;
+};
+
+#endif //OS_COURSE_WORK_INDEX_STATE_H
@@ -0,0 +1,665 @@
+#include "index_view.h"
+#include "helpers.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <numeric>
+#include <regex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <boost/log/trivial.hpp>
+
+using namespace soci;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::vector;
+
+string index_view::directory_path(uint32_t directory) const{
+    vector<uint32_t> chain;
+    for (uint32_t d = directory; d != no_directory; d = m_directory_parent[d]) {
+        chain.push_back(d);
+    }
+    string path(str(m_directory_name[chain.back()]));
+    for (auto it = chain.rbegin() + 1; it != chain.rend(); ++it) {
+        if(path.back() != '/'){
+            path += '/';
+        }
+        path += str(m_directory_name[*it]);
+    }
+    return path;
+}
+
+uint32_t index_view::find_directory(const string& path) const{
+    // directories without parent are the siblings starting at 0
+    for (uint32_t top = 0; top < m_directories_count; top = m_directory_subtree_end[top]) {
+        const auto name = str(m_directory_name[top]);
+        string_view rest(path);
+        if(rest == name){
+            return top;
+        }
+        if(rest.size() <= name.size() || rest.compare(0, name.size(), name) != 0 ||
+           (name.back() != '/' && rest[name.size()] != '/')){
+            continue;
+        }
+        rest.remove_prefix(name.back() == '/' ? name.size() : name.size() + 1);
+        // one component at a time, children are the siblings after their parent
+        uint32_t current = top;
+        while(!rest.empty()){
+            const auto slash = rest.find('/');
+            const auto component = rest.substr(0, slash);
+            uint32_t found = no_directory;
+            for (uint32_t child = current + 1; child < m_directory_subtree_end[current];
+                 child = m_directory_subtree_end[child]) {
+                if(str(m_directory_name[child]) == component){
+                    found = child;
+                    break;
+                }
+            }
+            if(found == no_directory){
+                return no_directory;
+            }
+            current = found;
+            rest.remove_prefix(slash == string_view::npos ? rest.size() : slash + 1);
+        }
+        return current;
+    }
+    return no_directory;
+}
+
+uint32_t index_view::directory_of_file(uint32_t file) const{
+    // the last directory whose files start at or before the file, empty directories before it share its start
+    const auto *end = m_directory_files + m_directories_count + 1;
+    return static_cast<uint32_t>(std::upper_bound(m_directory_files, end, file) - m_directory_files - 1);
+}
+
+namespace {
+    // directory names repeat a lot, every distinct one is stored once
+    class view_string_builder{
+    public:
+        explicit view_string_builder(string& strings): m_strings(strings){}
+
+        string_ref add(string_view value){
+            if(m_strings.size() + value.size() > UINT32_MAX){
+                throw std::length_error("index strings do not fit in 4 GiB");
+            }
+            string_ref ref{static_cast<uint32_t>(m_strings.size()), static_cast<uint32_t>(value.size())};
+            m_strings.append(value.data(), value.size());
+            return ref;
+        }
+
+        string_ref intern(string_view value){
+            auto it = m_interned.find(string(value));
+            if(it != m_interned.end()){
+                return it->second;
+            }
+            const auto ref = add(value);
+            m_interned.emplace(string(value), ref);
+            return ref;
+        }
+
+    private:
+        string &m_strings;
+        std::unordered_map<string, string_ref> m_interned;
+    };
+
+    struct loaded_file{
+        uint32_t m_directory;
+        uint32_t m_extension;
+        string m_name;
+        long long m_size;
+        long long m_changed;
+    };
+
+    template<class T>
+    std::size_t vector_bytes(const vector<T>& values){
+        return values.capacity() * sizeof(T);
+    }
+}
+
+void memory_index::load(session& sql){
+    BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
+    sql << "BEGIN TRANSACTION;";
+    vector<string> paths;
+    vector<int> parent_ids;
+    vector<bool> has_parent;
+    std::unordered_map<int, uint32_t> loaded_directories;
+    vector<std::pair<string, int>> extensions;
+    vector<loaded_file> files;
+    try{
+        int id, parent_id;
+        indicator parent_indicator;
+        string path;
+        statement directories_st = (sql.prepare << "SELECT id, parent_id, path FROM `directories`;",
+                into(id), into(parent_id, parent_indicator), into(path));
+        directories_st.execute();
+        while(directories_st.fetch()){
+            loaded_directories.emplace(id, static_cast<uint32_t>(paths.size()));
+            paths.push_back(path);
+            parent_ids.push_back(parent_id);
+            has_parent.push_back(parent_indicator == i_ok);
+        }
+
+        string extension;
+        statement extensions_st = (sql.prepare << "SELECT id, extension FROM `extensions`;", into(id), into(extension));
+        extensions_st.execute();
+        while(extensions_st.fetch()){
+            extensions.emplace_back(extension, id);
+        }
+
+        int directory_id, extension_id;
+        string filename;
+        long long size, changed;
+        statement files_st = (sql.prepare << "SELECT directory_id, extension_id, filename, file_size, last_changed_at "
+                                             "FROM `files`;",
+                into(directory_id), into(extension_id), into(filename), into(size), into(changed));
+        files_st.execute();
+        while(files_st.fetch()){
+            auto it = loaded_directories.find(directory_id);
+            if(it == loaded_directories.end()){
+                BOOST_LOG_TRIVIAL(warning) << "file " << filename << " has no directory " << directory_id;
+                continue;
+            }
+            // extension ids are replaced by positions once the extensions are sorted
+            files.push_back({it->second, static_cast<uint32_t>(extension_id), filename, size, changed});
+        }
+        BOOST_LOG_TRIVIAL(debug) << "committing transaction";
+        sql << "COMMIT;";
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(info) << "rolling back";
+        sql << "ROLLBACK;";
+        throw;
+    }
+
+    m_strings.clear();
+    view_string_builder pool(m_strings);
+
+    // the directory tree in preorder, children sorted by name
+    const auto directories_count = static_cast<uint32_t>(paths.size());
+    vector<string_view> names(directories_count);
+    vector<vector<uint32_t>> children(directories_count);
+    vector<uint32_t> tops;
+    for (uint32_t i = 0; i < directories_count; ++i) {
+        auto parent = has_parent[i] ? loaded_directories.find(parent_ids[i]) : loaded_directories.end();
+        if(parent == loaded_directories.end()){
+            names[i] = paths[i];
+            tops.push_back(i);
+        } else{
+            names[i] = string_view(paths[i]).substr(paths[i].rfind('/') + 1);
+            children[parent->second].push_back(i);
+        }
+    }
+    auto by_name = [&names](uint32_t a, uint32_t b){ return names[a] < names[b]; };
+    std::sort(tops.begin(), tops.end(), by_name);
+    vector<uint32_t> stack(tops.rbegin(), tops.rend());
+    vector<uint32_t> position(directories_count, no_directory), preorder;
+    preorder.reserve(directories_count);
+    while(!stack.empty()){
+        const uint32_t loaded = stack.back();
+        stack.pop_back();
+        position[loaded] = static_cast<uint32_t>(preorder.size());
+        preorder.push_back(loaded);
+        auto &kids = children[loaded];
+        std::sort(kids.begin(), kids.end(), by_name);
+        stack.insert(stack.end(), kids.rbegin(), kids.rend());
+    }
+
+    m_directory_name.assign(directories_count, string_ref{});
+    m_directory_parent.assign(directories_count, no_directory);
+    m_directory_depth.assign(directories_count, 0);
+    m_directory_subtree_end.assign(directories_count, 0);
+    for (uint32_t d = 0; d < directories_count; ++d) {
+        const uint32_t loaded = preorder[d];
+        m_directory_name[d] = pool.intern(names[loaded]);
+        m_directory_depth[d] = static_cast<uint32_t>(path_depth(paths[loaded]));
+        m_directory_subtree_end[d] = d + 1;
+        auto parent = has_parent[loaded] ? loaded_directories.find(parent_ids[loaded]) : loaded_directories.end();
+        if(parent != loaded_directories.end()){
+            m_directory_parent[d] = position[parent->second];
+        }
+    }
+    // a subtree ends where its last descendant does, children come after their parent
+    for (uint32_t d = directories_count; d-- > 0;) {
+        if(m_directory_parent[d] != no_directory){
+            auto &end = m_directory_subtree_end[m_directory_parent[d]];
+            end = std::max(end, m_directory_subtree_end[d]);
+        }
+    }
+
+    std::sort(extensions.begin(), extensions.end());
+    const auto extensions_count = static_cast<uint32_t>(extensions.size());
+    std::unordered_map<int, uint32_t> extension_position;
+    m_extension_name.clear();
+    for (uint32_t e = 0; e < extensions_count; ++e) {
+        extension_position.emplace(extensions[e].second, e);
+        m_extension_name.push_back(pool.add(extensions[e].first));
+    }
+
+    for (auto &file : files) {
+        file.m_directory = position[file.m_directory];
+        file.m_extension = extension_position.at(static_cast<int>(file.m_extension));
+    }
+    std::sort(files.begin(), files.end(), [](const loaded_file& a, const loaded_file& b){
+        return a.m_directory != b.m_directory ? a.m_directory < b.m_directory : a.m_name < b.m_name;
+    });
+    const auto files_count = static_cast<uint32_t>(files.size());
+    m_file_name.clear();
+    m_file_size.clear();
+    m_file_changed.clear();
+    m_size_prefix.assign(1, 0);
+    m_directory_files.assign(directories_count + 1, 0);
+    m_extension_files.assign(extensions_count + 1, 0);
+    for (const auto &file : files) {
+        m_file_name.push_back(pool.add(file.m_name));
+        m_file_size.push_back(file.m_size);
+        m_file_changed.push_back(file.m_changed);
+        m_size_prefix.push_back(m_size_prefix.back() + static_cast<std::uint64_t>(file.m_size));
+        ++m_directory_files[file.m_directory + 1];
+        ++m_extension_files[file.m_extension + 1];
+    }
+    std::partial_sum(m_directory_files.begin(), m_directory_files.end(), m_directory_files.begin());
+    std::partial_sum(m_extension_files.begin(), m_extension_files.end(), m_extension_files.begin());
+    // buckets are filled in file order, so every bucket is sorted too
+    m_extension_file_ids.assign(files_count, 0);
+    vector<uint32_t> next(m_extension_files.begin(), m_extension_files.end() - 1);
+    for (uint32_t f = 0; f < files_count; ++f) {
+        m_extension_file_ids[next[files[f].m_extension]++] = f;
+    }
+    files.clear();
+    files.shrink_to_fit();
+
+    m_name_order.resize(files_count);
+    std::iota(m_name_order.begin(), m_name_order.end(), 0);
+    m_size_order = m_name_order;
+    m_changed_order = m_name_order;
+    const string &strings = m_strings;
+    std::sort(m_name_order.begin(), m_name_order.end(), [this, &strings](uint32_t a, uint32_t b){
+        return string_view(strings.data() + m_file_name[a].m_offset, m_file_name[a].m_length) <
+               string_view(strings.data() + m_file_name[b].m_offset, m_file_name[b].m_length);
+    });
+    std::sort(m_size_order.begin(), m_size_order.end(),
+              [this](uint32_t a, uint32_t b){ return m_file_size[a] < m_file_size[b]; });
+    std::sort(m_changed_order.begin(), m_changed_order.end(),
+              [this](uint32_t a, uint32_t b){ return m_file_changed[a] < m_file_changed[b]; });
+    update_view();
+    BOOST_LOG_TRIVIAL(info) << "loaded " << files_count << " files in " << directories_count << " directories, "
+                            << memory_size() << " bytes";
+}
+
+std::size_t memory_index::memory_size() const{
+    return m_strings.capacity() + vector_bytes(m_directory_name) + vector_bytes(m_directory_parent) +
+           vector_bytes(m_directory_subtree_end) + vector_bytes(m_directory_depth) + vector_bytes(m_directory_files) +
+           vector_bytes(m_file_name) + vector_bytes(m_file_size) + vector_bytes(m_file_changed) +
+           vector_bytes(m_size_prefix) + vector_bytes(m_name_order) + vector_bytes(m_size_order) +
+           vector_bytes(m_changed_order) + vector_bytes(m_extension_name) + vector_bytes(m_extension_files) +
+           vector_bytes(m_extension_file_ids);
+}
+
+void memory_index::update_view(){
+    m_view = index_view();
+    m_view.m_strings = m_strings.data();
+    m_view.m_strings_size = m_strings.size();
+    m_view.m_directories_count = static_cast<uint32_t>(m_directory_name.size());
+    m_view.m_directory_name = m_directory_name.data();
+    m_view.m_directory_parent = m_directory_parent.data();
+    m_view.m_directory_subtree_end = m_directory_subtree_end.data();
+    m_view.m_directory_depth = m_directory_depth.data();
+    m_view.m_directory_files = m_directory_files.data();
+    m_view.m_files_count = static_cast<uint32_t>(m_file_name.size());
+    m_view.m_file_name = m_file_name.data();
+    m_view.m_file_size = m_file_size.data();
+    m_view.m_file_changed = m_file_changed.data();
+    m_view.m_size_prefix = m_size_prefix.data();
+    m_view.m_name_order = m_name_order.data();
+    m_view.m_size_order = m_size_order.data();
+    m_view.m_changed_order = m_changed_order.data();
+    m_view.m_extensions_count = static_cast<uint32_t>(m_extension_name.size());
+    m_view.m_extension_name = m_extension_name.data();
+    m_view.m_extension_files = m_extension_files.data();
+    m_view.m_extension_file_ids = m_extension_file_ids.data();
+}
+
+namespace {
+    // next UTF-8 character, a byte that starts no valid sequence is a character of its own
+    uint32_t next_char(const char*& p, const char* end){
+        const auto first = static_cast<unsigned char>(*p++);
+        if(first < 0xC0){
+            return first;
+        }
+        int extra = first >= 0xF0 ? 3 : first >= 0xE0 ? 2 : 1;
+        uint32_t value = first & (0x3Fu >> extra);
+        while(extra-- > 0 && p < end && (static_cast<unsigned char>(*p) & 0xC0) == 0x80){
+            value = (value << 6) | (static_cast<unsigned char>(*p++) & 0x3F);
+        }
+        return value;
+    }
+
+    // GLOB of sqlite: * and ? match characters, [...] is a class with ranges and ^ for negation
+    bool glob_match(const char* p, const char* p_end, const char* s, const char* s_end){
+        while(p < p_end){
+            const uint32_t c = next_char(p, p_end);
+            if(c == '*'){
+                while(p < p_end && *p == '*'){
+                    ++p;
+                }
+                if(p == p_end){
+                    return true;
+                }
+                while(true){
+                    if(glob_match(p, p_end, s, s_end)){
+                        return true;
+                    }
+                    if(s == s_end){
+                        return false;
+                    }
+                    next_char(s, s_end);
+                }
+            }
+            if(s == s_end){
+                return false;
+            }
+            const uint32_t sc = next_char(s, s_end);
+            if(c == '?'){
+                continue;
+            }
+            if(c != '['){
+                if(c != sc){
+                    return false;
+                }
+                continue;
+            }
+            bool negate = false, seen = false, closed = false;
+            if(p < p_end && *p == '^'){
+                negate = true;
+                ++p;
+            }
+            uint32_t prior = 0;
+            for (bool first = true; p < p_end; first = false) {
+                uint32_t cc = next_char(p, p_end);
+                if(cc == ']' && !first){
+                    closed = true;
+                    break;
+                }
+                if(cc == '-' && prior != 0 && p < p_end && *p != ']'){
+                    const uint32_t high = next_char(p, p_end);
+                    seen = seen || (sc >= prior && sc <= high);
+                    prior = 0;
+                } else{
+                    seen = seen || sc == cc;
+                    prior = cc;
+                }
+            }
+            if(!closed || seen == negate){
+                return false;
+            }
+        }
+        return s == s_end;
+    }
+
+    bool matches_filters(const index_view& view, const view_query& query, uint32_t file){
+        const auto size = view.m_file_size[file], changed = view.m_file_changed[file];
+        return (!query.m_min_size || size >= *query.m_min_size) && (!query.m_max_size || size <= *query.m_max_size) &&
+               (!query.m_changed_after || changed >= *query.m_changed_after) &&
+               (!query.m_changed_before || changed < *query.m_changed_before);
+    }
+
+    uint32_t find_extension(const index_view& view, const string& extension){
+        const auto *end = view.m_extension_name + view.m_extensions_count;
+        const auto *it = std::lower_bound(view.m_extension_name, end, extension,
+                                          [&view](const string_ref& ref, const string& value){ return view.str(ref) < value; });
+        return it != end && view.str(*it) == extension ? static_cast<uint32_t>(it - view.m_extension_name) : UINT32_MAX;
+    }
+
+    // writes found files, the path of the last directory is kept since files mostly come in directory order
+    class found_printer{
+    public:
+        found_printer(const index_view& view, result_writer& writer): m_view(view), m_writer(writer){}
+
+        void print(uint32_t file){
+            print(m_view.directory_of_file(file), file);
+        }
+
+        void print(uint32_t directory, uint32_t file){
+            if(directory != m_directory){
+                m_directory = directory;
+                m_path = m_view.directory_path(directory);
+            }
+            m_writer.add(m_path, m_view.str(m_view.m_file_name[file]), m_view.m_file_size[file], m_view.m_file_changed[file]);
+        }
+
+    private:
+        const index_view &m_view;
+        result_writer &m_writer;
+        uint32_t m_directory = no_directory;
+        string m_path;
+    };
+
+    bool resolve_directory(const string& target, string& path, string& error){
+        char rpath[PATH_MAX];
+        if(realpath(target.c_str(), rpath) == nullptr){
+            error = "Invalid directory: " + target;
+            return false;
+        }
+        path = rpath;
+        return true;
+    }
+
+    void print_extension_stat(const index_view& view, std::ostream& out){
+        out << "Total files count: " << view.m_files_count << '\n';
+        out << "Total extensions count: " << view.m_extensions_count << '\n';
+        vector<uint32_t> extensions;
+        for (uint32_t e = 0; e < view.m_extensions_count; ++e) {
+            if(view.m_extension_files[e + 1] != view.m_extension_files[e]){
+                extensions.push_back(e);
+            }
+        }
+        auto count = [&view](uint32_t e){ return view.m_extension_files[e + 1] - view.m_extension_files[e]; };
+        const auto limit = std::min<std::size_t>(stat_ext_sql_limit, extensions.size());
+        std::partial_sort(extensions.begin(), extensions.begin() + limit, extensions.end(),
+                          [&count](uint32_t a, uint32_t b){ return count(a) > count(b); });
+        for (std::size_t i = 0; i < limit; ++i) {
+            const auto extension = view.str(view.m_extension_name[extensions[i]]);
+            if(extension.empty()){
+                out << "Total files without extensions: " << count(extensions[i]) << '\n';
+            } else{
+                out << "Total files with extension " << std::quoted(string(extension)) << " are "
+                    << count(extensions[i]) << '\n';
+            }
+        }
+        if(view.m_files_count == 0){
+            return;
+        }
+        const uint32_t biggest = view.m_size_order[view.m_files_count - 1];
+        out << "Biggest file with size " << view.m_file_size[biggest] << "B is "
+            << join_path(view.directory_path(view.directory_of_file(biggest)), view.str(view.m_file_name[biggest]))
+            << '\n';
+        out << "Mean file size is " << std::fixed << std::setprecision(2)
+            << static_cast<double>(view.m_size_prefix[view.m_files_count]) / static_cast<double>(view.m_files_count)
+            << "B" << '\n';
+    }
+
+    // largest subtrees by cumulative size, every subtree is a contiguous range of files
+    bool print_directory_stat(const index_view& view, const view_query& query, std::ostream& out, string& error){
+        string target = "/";
+        if(query.m_target && !resolve_directory(*query.m_target, target, error)){
+            return false;
+        }
+        const uint32_t root = view.find_directory(target);
+        if(root == no_directory){
+            return true;
+        }
+        const uint32_t max_depth = query.m_depth < 0 ? UINT32_MAX : view.m_directory_depth[root] + query.m_depth;
+        vector<uint32_t> subtrees;
+        for (uint32_t d = root; d < view.m_directory_subtree_end[root]; ++d) {
+            if(view.m_directory_depth[d] <= max_depth){
+                subtrees.push_back(d);
+            }
+        }
+        auto first_file = [&view](uint32_t d){ return view.m_directory_files[d]; };
+        auto end_file = [&view](uint32_t d){ return view.m_directory_files[view.m_directory_subtree_end[d]]; };
+        auto total_size = [&](uint32_t d){ return view.m_size_prefix[end_file(d)] - view.m_size_prefix[first_file(d)]; };
+        const auto limit = std::min<std::size_t>(stat_directory_limit, subtrees.size());
+        std::partial_sort(subtrees.begin(), subtrees.begin() + limit, subtrees.end(),
+                          [&total_size](uint32_t a, uint32_t b){ return total_size(a) > total_size(b); });
+        for (std::size_t i = 0; i < limit; ++i) {
+            const uint32_t d = subtrees[i];
+            out << "Subtree " << view.directory_path(d) << " has " << end_file(d) - first_file(d)
+                << " files with total size " << total_size(d) << "B" << '\n';
+        }
+        return true;
+    }
+}
+
+bool search_view(const index_view& view, const view_query& query, result_writer& writer, string& error){
+    const auto &search_by = query.m_by;
+    if(!query.m_target && (search_by == "extension" || search_by == "directory" || search_by == "name")){
+        error = "Search by " + search_by + " needs a target";
+        return false;
+    }
+    found_printer printer(view, writer);
+    auto print_matching = [&](uint32_t file){
+        if(matches_filters(view, query, file)){
+            printer.print(file);
+        }
+    };
+
+    if(search_by == "extension"){
+        const uint32_t extension = find_extension(view, *query.m_target);
+        if(extension != UINT32_MAX){
+            for (uint32_t i = view.m_extension_files[extension]; i < view.m_extension_files[extension + 1] && !writer.full(); ++i) {
+                print_matching(view.m_extension_file_ids[i]);
+            }
+        }
+    } else if(search_by == "directory"){
+        string target;
+        if(!resolve_directory(*query.m_target, target, error)){
+            return false;
+        }
+        const uint32_t root = view.find_directory(target);
+        if(root == no_directory){
+            return true;
+        }
+        const uint32_t end = query.m_recursive ? view.m_directory_subtree_end[root] : root + 1;
+        const uint32_t max_depth = !query.m_recursive || query.m_depth < 0 ? UINT32_MAX
+                                                                            : view.m_directory_depth[root] + query.m_depth;
+        for (uint32_t d = root; d < end && !writer.full(); ++d) {
+            if(view.m_directory_depth[d] > max_depth){
+                continue;
+            }
+            for (uint32_t file = view.m_directory_files[d]; file < view.m_directory_files[d + 1] && !writer.full(); ++file) {
+                if(matches_filters(view, query, file)){
+                    printer.print(d, file);
+                }
+            }
+        }
+    } else if(search_by == "name" && query.m_regex){
+        std::regex name_regex;
+        try{
+            name_regex = std::regex(*query.m_target);
+        } catch (const std::regex_error& err){
+            error = "Invalid regex: " + *query.m_target + ": " + err.what();
+            return false;
+        }
+        for (uint32_t file = 0; file < view.m_files_count && !writer.full(); ++file) {
+            const auto name = view.str(view.m_file_name[file]);
+            if(std::regex_search(name.data(), name.data() + name.size(), name_regex)){
+                print_matching(file);
+            }
+        }
+    } else if(search_by == "name"){
+        const string &pattern = *query.m_target;
+        const auto wildcard = pattern.find_first_of("*?[");
+        if(wildcard == string::npos){
+            // a plain target is a substring, searched in all names at once, a hit across two names is skipped
+            const auto *names = view.m_file_name, *names_end = view.m_file_name + view.m_files_count;
+            const char *begin = view.m_files_count == 0 ? nullptr : view.m_strings + names->m_offset;
+            const char *end = view.m_files_count == 0 ? nullptr
+                                                      : view.m_strings + names_end[-1].m_offset + names_end[-1].m_length;
+            while(begin != end && !pattern.empty() && !writer.full()){
+                const auto *hit = static_cast<const char*>(memmem(begin, end - begin, pattern.data(), pattern.size()));
+                if(hit == nullptr){
+                    break;
+                }
+                const auto offset = static_cast<uint32_t>(hit - view.m_strings);
+                names = std::upper_bound(names, names_end, offset,
+                                         [](uint32_t value, const string_ref& ref){ return value < ref.m_offset; }) - 1;
+                const uint32_t name_end = names->m_offset + names->m_length;
+                if(offset + pattern.size() <= name_end){
+                    print_matching(static_cast<uint32_t>(names - view.m_file_name));
+                    // one line per file however often it matches
+                    begin = view.m_strings + name_end;
+                } else{
+                    begin = hit + 1;
+                }
+            }
+        } else{
+            // names with the literal prefix of the pattern are a range of the sorted names
+            const string_view prefix = string_view(pattern).substr(0, wildcard);
+            const auto *begin = view.m_name_order, *end = view.m_name_order + view.m_files_count;
+            if(!prefix.empty()){
+                auto name = [&view](uint32_t file){ return view.str(view.m_file_name[file]); };
+                begin = std::partition_point(begin, end, [&](uint32_t file){ return name(file) < prefix; });
+                end = std::partition_point(begin, end, [&](uint32_t file){
+                    return name(file).compare(0, prefix.size(), prefix) == 0;
+                });
+            }
+            for (const auto *it = begin; it != end && !writer.full(); ++it) {
+                const auto name = view.str(view.m_file_name[*it]);
+                if(glob_match(pattern.data(), pattern.data() + pattern.size(), name.data(), name.data() + name.size())){
+                    print_matching(*it);
+                }
+            }
+        }
+    } else if(search_by == "size" || search_by == "changed"){
+        if(!query.m_min_size && !query.m_max_size && !query.m_changed_after && !query.m_changed_before){
+            error = "Search by " + search_by + " needs --min/--max or --changed-after/--changed-before";
+            return false;
+        }
+        // a range of the size order or of the modification time order, other filters are checked per file
+        const auto *begin = view.m_size_order, *end = view.m_size_order + view.m_files_count;
+        if(query.m_min_size || query.m_max_size){
+            if(query.m_min_size){
+                begin = std::partition_point(begin, end, [&](uint32_t f){ return view.m_file_size[f] < *query.m_min_size; });
+            }
+            if(query.m_max_size){
+                end = std::partition_point(begin, end, [&](uint32_t f){ return view.m_file_size[f] <= *query.m_max_size; });
+            }
+        } else{
+            begin = view.m_changed_order;
+            end = view.m_changed_order + view.m_files_count;
+            if(query.m_changed_after){
+                begin = std::partition_point(begin, end, [&](uint32_t f){
+                    return view.m_file_changed[f] < *query.m_changed_after;
+                });
+            }
+            if(query.m_changed_before){
+                end = std::partition_point(begin, end, [&](uint32_t f){
+                    return view.m_file_changed[f] < *query.m_changed_before;
+                });
+            }
+        }
+        for (const auto *it = begin; it != end && !writer.full(); ++it) {
+            print_matching(*it);
+        }
+    } else{
+        error = "Invalid argument: " + search_by;
+        return false;
+    }
+    return true;
+}
+
+bool stat_view(const index_view& view, const view_query& query, std::ostream& out, string& error){
+    if(query.m_by == "extension"){
+        print_extension_stat(view, out);
+        return true;
+    }
+    if(query.m_by == "directory"){
+        return print_directory_stat(view, query, out, error);
+    }
+    error = "Invalid argument: " + query.m_by;
+    return false;
+}
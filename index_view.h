@@ -0,0 +1,126 @@
+#ifndef OS_COURSE_WORK_INDEX_VIEW_H
+#define OS_COURSE_WORK_INDEX_VIEW_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include <soci/soci.h>
+
+#include "result_writer.h"
+
+// a string in the string pool of an index view
+struct string_ref{
+    std::uint32_t m_offset;
+    std::uint32_t m_length;
+};
+
+static const std::uint32_t no_directory = 0xFFFFFFFFu;
+
+// Read-only columns of a whole index. The arrays are owned by a memory_index or point into a mapped file,
+// queries do not care where they come from.
+// Directories are in preorder with children sorted by name, so a subtree is [i, directory_subtree_end[i]).
+// Files are sorted by directory and name, directory i has the files [directory_files[i], directory_files[i + 1])
+// and the files of a subtree are contiguous too.
+struct index_view{
+    const char *m_strings = nullptr;
+    std::uint64_t m_strings_size = 0;
+
+    std::uint32_t m_directories_count = 0;
+    // last path component, a directory without parent has its full path
+    const string_ref *m_directory_name = nullptr;
+    const std::uint32_t *m_directory_parent = nullptr;
+    const std::uint32_t *m_directory_subtree_end = nullptr;
+    // path_depth() of the path
+    const std::uint32_t *m_directory_depth = nullptr;
+    // directories_count + 1 entries
+    const std::uint32_t *m_directory_files = nullptr;
+
+    std::uint32_t m_files_count = 0;
+    // the names are stored one after another in file order, a substring search is one scan of the pool
+    const string_ref *m_file_name = nullptr;
+    const std::int64_t *m_file_size = nullptr;
+    // nanoseconds since epoch
+    const std::int64_t *m_file_changed = nullptr;
+    // files_count + 1 entries, total size of the files before each file
+    const std::uint64_t *m_size_prefix = nullptr;
+    // file numbers sorted by name, by size and by modification time
+    const std::uint32_t *m_name_order = nullptr;
+    const std::uint32_t *m_size_order = nullptr;
+    const std::uint32_t *m_changed_order = nullptr;
+
+    // extensions sorted by name, extension i has the files
+    // extension_file_ids[extension_files[i]] .. extension_file_ids[extension_files[i + 1] - 1]
+    std::uint32_t m_extensions_count = 0;
+    const string_ref *m_extension_name = nullptr;
+    const std::uint32_t *m_extension_files = nullptr;
+    const std::uint32_t *m_extension_file_ids = nullptr;
+
+    std::string_view str(const string_ref& ref) const{
+        return std::string_view(m_strings + ref.m_offset, ref.m_length);
+    }
+    std::string directory_path(std::uint32_t directory) const;
+    // the directory with this absolute path or no_directory
+    std::uint32_t find_directory(const std::string& path) const;
+    std::uint32_t directory_of_file(std::uint32_t file) const;
+};
+
+// The whole index loaded from the database into flat arrays, what `serve` answers from.
+// Not copyable, the view points into the vectors.
+class memory_index{
+public:
+    memory_index() = default;
+    memory_index(const memory_index&) = delete;
+    memory_index& operator=(const memory_index&) = delete;
+
+    // reads all tables in one transaction, so the view is consistent
+    void load(soci::session& sql);
+    const index_view& view() const { return m_view; }
+    // bytes held by the arrays
+    std::size_t memory_size() const;
+
+private:
+    void update_view();
+
+    std::string m_strings;
+    std::vector<string_ref> m_directory_name;
+    std::vector<std::uint32_t> m_directory_parent;
+    std::vector<std::uint32_t> m_directory_subtree_end;
+    std::vector<std::uint32_t> m_directory_depth;
+    std::vector<std::uint32_t> m_directory_files;
+    std::vector<string_ref> m_file_name;
+    std::vector<std::int64_t> m_file_size;
+    std::vector<std::int64_t> m_file_changed;
+    std::vector<std::uint64_t> m_size_prefix;
+    std::vector<std::uint32_t> m_name_order;
+    std::vector<std::uint32_t> m_size_order;
+    std::vector<std::uint32_t> m_changed_order;
+    std::vector<string_ref> m_extension_name;
+    std::vector<std::uint32_t> m_extension_files;
+    std::vector<std::uint32_t> m_extension_file_ids;
+    index_view m_view;
+};
+
+// one search or stat request with the options of the command line
+struct view_query{
+    std::string m_by = "extension";
+    boost::optional<std::string> m_target;
+    boost::optional<long long> m_min_size;
+    boost::optional<long long> m_max_size;
+    boost::optional<long long> m_changed_after;
+    boost::optional<long long> m_changed_before;
+    bool m_regex = false;
+    bool m_recursive = false;
+    int m_depth = -1;
+};
+
+// Both print the same output as search and stat on the database.
+// A query that can not run returns false with the reason in `error`.
+bool search_view(const index_view& view, const view_query& query, result_writer& writer, std::string& error);
+bool stat_view(const index_view& view, const view_query& query, std::ostream& out, std::string& error);
+
+#endif //OS_COURSE_WORK_INDEX_VIEW_H
@@ -0,0 +1,338 @@
+#include "index_writer.h"
+#include "index_state.h"
+#include "helpers.h"
+#include "metrics.h"
+
+#include <boost/log/trivial.hpp>
+
+using namespace soci;
+using std::string;
+using std::string_view;
+
+index_writer::index_writer(session& sql, std::size_t batch_size, std::chrono::milliseconds batch_interval,
+                           long long scan_generation, index_state* state)
+        : m_sql(sql), m_batch_size(batch_size == 0 ? 1 : batch_size), m_batch_interval(batch_interval),
+          m_scan_generation(scan_generation), m_state(state),
+          m_select_file((sql.prepare << "SELECT id FROM `files` WHERE directory_id = :directory AND filename = :filename;",
+                  use(m_bound_directory_id, "directory"), use(m_bound_filename, "filename"), into(m_bound_file_id))),
+          m_insert_file((sql.prepare << "INSERT INTO `files`(directory_id, filename, file_size, last_changed_at, extension_id, "
+                                        "scan_generation, content_hash) "
+                                        "VALUES (:directory, :filename, :size, :changed, :extension, :generation, :hash);",
+                  use(m_bound_directory_id, "directory"), use(m_bound_filename, "filename"), use(m_bound_size, "size"),
+                  use(m_bound_last_changed, "changed"), use(m_bound_extension_id, "extension"),
+                  use(m_scan_generation, "generation"), use(m_bound_hash, m_bound_hash_indicator, "hash"))),
+          // SET expressions see the old row: the stored hash is kept when the new size and mtime equal the stored ones
+          // and no new hash was computed, a changed file takes the new hash or none
+          m_update_file((sql.prepare << "UPDATE `files` SET "
+                                        "content_hash = CASE WHEN file_size = :same_size AND last_changed_at = :same_changed "
+                                        "THEN coalesce(:hash, content_hash) ELSE :new_hash END ,"
+                                        "file_size = :size ,"
+                                        "last_changed_at = :changed ,"
+                                        "scan_generation = :generation "
+                                        "WHERE id = :id ;",
+                  use(m_bound_size, "same_size"), use(m_bound_last_changed, "same_changed"),
+                  use(m_bound_hash, m_bound_hash_indicator, "hash"), use(m_bound_hash, m_bound_hash_indicator, "new_hash"),
+                  use(m_bound_size, "size"), use(m_bound_last_changed, "changed"),
+                  use(m_scan_generation, "generation"), use(m_bound_file_id, "id"))),
+          m_insert_file_name((sql.prepare << "INSERT INTO `files_names`(rowid, filename) VALUES (:id, :filename);",
+                  use(m_bound_file_id, "id"), use(m_bound_filename, "filename"))),
+          m_select_directory((sql.prepare << "SELECT id FROM `directories` WHERE path = :path ;",
+                  use(m_bound_path, "path"), into(m_bound_directory_id))),
+          m_insert_directory((sql.prepare << "INSERT INTO `directories`(parent_id, path) VALUES (:parent, :path);",
+                  use(m_bound_parent_id, m_bound_parent_indicator, "parent"), use(m_bound_path, "path"))){
+    m_batch.reserve(m_batch_size);
+    load_extensions();
+}
+
+index_writer::~index_writer(){
+    if(!m_batch.empty()){
+        BOOST_LOG_TRIVIAL(warning) << "index writer destroyed with " << m_batch.size() << " unflushed records";
+    }
+}
+
+void index_writer::add(file_record record){
+    if(m_state != nullptr){
+        index_entry* entry = m_state->find(record.m_directory, record.m_filename);
+        if(entry != nullptr){
+            entry->m_seen = true;
+            if(index_state::is_unchanged(*entry, record)){
+                ++m_unchanged_count;
+                add_metric(get_metrics().m_rows_unchanged, 1);
+                return;
+            }
+        }
+    }
+    if(m_batch.empty()){
+        m_batch_started = std::chrono::steady_clock::now();
+    }
+    m_batch.push_back(std::move(record));
+    if(m_batch.size() >= m_batch_size ||
+       std::chrono::steady_clock::now() - m_batch_started >= m_batch_interval){
+        flush();
+    }
+}
+
+void index_writer::flush(){
+    if(m_batch.empty()){
+        return;
+    }
+    BOOST_LOG_TRIVIAL(debug) << "flushing batch of " << m_batch.size() << " records";
+    if(!write_batch()){
+        write_batch_by_one();
+    }
+    m_batch.clear();
+}
+
+void index_writer::flush_expired(){
+    if(!m_batch.empty() && std::chrono::steady_clock::now() - m_batch_started >= m_batch_interval){
+        flush();
+    }
+}
+
+bool index_writer::write_batch(){
+    std::size_t inserted = 0, updated = 0;
+    auto &metrics = get_metrics();
+    try {
+        BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
+        m_sql << "BEGIN TRANSACTION;";
+        {
+            metrics_timer timer(metrics.m_sql_ns);
+            for (const auto &record : m_batch) {
+                if(write_record(record)){
+                    ++inserted;
+                } else{
+                    ++updated;
+                }
+            }
+            write_new_names();
+        }
+        BOOST_LOG_TRIVIAL(debug) << "committing";
+        {
+            metrics_timer timer(metrics.m_commit_ns);
+            m_sql << "COMMIT;";
+        }
+        m_uncommitted_directories.clear();
+        m_uncommitted_extensions.clear();
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(info) << "rolling back batch";
+        m_sql << "ROLLBACK;";
+        forget_uncommitted();
+        BOOST_LOG_TRIVIAL(error) << "Error occurred while writing batch of " << m_batch.size()
+                                 << " files, retrying them one by one: " << err.what();
+        return false;
+    }
+    m_inserted_count += inserted;
+    m_updated_count += updated;
+    add_metric(metrics.m_rows_inserted, inserted);
+    add_metric(metrics.m_rows_updated, updated);
+    add_metric(metrics.m_batches, 1);
+    add_metric(metrics.m_batch_records, m_batch.size());
+    max_metric(metrics.m_batch_max_records, m_batch.size());
+    return true;
+}
+
+void index_writer::write_batch_by_one(){
+    for (const auto &record : m_batch) {
+        try {
+            m_sql << "BEGIN TRANSACTION;";
+            bool inserted = write_record(record);
+            write_new_names();
+            m_sql << "COMMIT;";
+            m_uncommitted_directories.clear();
+            m_uncommitted_extensions.clear();
+            if(inserted){
+                ++m_inserted_count;
+                add_metric(get_metrics().m_rows_inserted, 1);
+            } else{
+                ++m_updated_count;
+                add_metric(get_metrics().m_rows_updated, 1);
+            }
+        } catch (const std::exception& err){
+            BOOST_LOG_TRIVIAL(info) << "rolling back";
+            m_sql << "ROLLBACK;";
+            forget_uncommitted();
+            BOOST_LOG_TRIVIAL(error) << "Error occurred while indexing file "
+                                     << record.m_directory << "/" << record.m_filename << ": " << err.what();
+            ++m_failed_count;
+            add_metric(get_metrics().m_rows_failed, 1);
+        }
+    }
+}
+
+void index_writer::write_new_names(){
+    for (auto &name : m_new_names) {
+        m_bound_file_id = name.first;
+        m_bound_filename.assign(name.second.data(), name.second.size());
+        m_insert_file_name.execute(true);
+    }
+    m_new_names.clear();
+}
+
+void index_writer::forget_uncommitted(){
+    m_new_names.clear();
+    for (const auto &path : m_uncommitted_directories) {
+        m_directory_ids.erase(path);
+    }
+    m_uncommitted_directories.clear();
+    for (const auto &ext : m_uncommitted_extensions) {
+        m_extension_ids.erase(ext);
+    }
+    m_uncommitted_extensions.clear();
+}
+
+void index_writer::forget_directories(){
+    m_directory_ids.clear();
+    m_uncommitted_directories.clear();
+    m_directory_keys = string_pool();
+}
+
+int index_writer::find_or_create_directory(string_view path){
+    auto it = m_directory_ids.find(path);
+    if(it != m_directory_ids.end()){
+        return it->second;
+    }
+    BOOST_LOG_TRIVIAL(trace) << "selecting directory from db";
+    // the record's view dies with its batch, the map keeps a copy
+    path = m_directory_keys.add(path);
+    m_bound_path.assign(path.data(), path.size());
+    int directory_id;
+    if(m_select_directory.execute(true)){
+        directory_id = m_bound_directory_id;
+    } else{
+        BOOST_LOG_TRIVIAL(trace) << "directory not found. creating new directory";
+        m_bound_parent_indicator = i_null;
+        int parent_id = 0;
+        if(path != "/"){
+            auto slash = path.rfind('/');
+            parent_id = find_or_create_directory(slash == 0 ? string_view("/") : path.substr(0, slash));
+        }
+        // the recursive call above reuses the bound buffers
+        m_bound_path.assign(path.data(), path.size());
+        m_bound_parent_id = parent_id;
+        m_bound_parent_indicator = path != "/" ? i_ok : i_null;
+        m_insert_directory.execute(true);
+        long long id = 0;
+        m_sql.get_last_insert_id("directories", id);
+        directory_id = static_cast<int>(id);
+        m_uncommitted_directories.push_back(path);
+    }
+    m_directory_ids.emplace(path, directory_id);
+    return directory_id;
+}
+
+void index_writer::load_extensions(){
+    int id;
+    string ext;
+    statement st = (m_sql.prepare << "SELECT id, extension FROM `extensions`;", into(id), into(ext));
+    st.execute();
+    while(st.fetch()){
+        m_extension_ids.emplace(m_extension_keys.add(ext), id);
+    }
+    BOOST_LOG_TRIVIAL(debug) << "loaded " << m_extension_ids.size() << " extensions";
+}
+
+int index_writer::find_or_create_extension(string_view ext){
+    auto it = m_extension_ids.find(ext);
+    if(it != m_extension_ids.end()){
+        return it->second;
+    }
+    BOOST_LOG_TRIVIAL(trace) << "extension not found. creating new extension";
+    const string bound_ext(ext);
+    m_sql << "INSERT INTO `extensions`(extension) VALUES (:ext);", use(bound_ext, "ext");
+    long long id = 0;
+    m_sql.get_last_insert_id("extensions", id);
+    ext = m_extension_keys.add(ext);
+    m_extension_ids.emplace(ext, static_cast<int>(id));
+    m_uncommitted_extensions.push_back(ext);
+    return static_cast<int>(id);
+}
+
+bool index_writer::write_record(const file_record& record){
+    BOOST_LOG_TRIVIAL(debug) << "indexing file " << record.m_directory << "/" << record.m_filename;
+    m_bound_size = record.m_size;
+    m_bound_last_changed = timespec_to_ns(record.m_last_changed);
+    m_bound_hash = record.m_content_hash;
+    m_bound_hash_indicator = record.m_hashed ? i_ok : i_null;
+
+    bool found;
+    if(m_state != nullptr){
+        // the state was loaded for everything under the roots, a miss means a new file
+        const index_entry* entry = m_state->find(record.m_directory, record.m_filename);
+        found = entry != nullptr;
+        if(found){
+            m_bound_file_id = entry->m_id;
+        }
+    } else{
+        m_bound_directory_id = find_or_create_directory(record.m_directory);
+        m_bound_filename.assign(record.m_filename.data(), record.m_filename.size());
+        found = m_select_file.execute(true);
+    }
+    if(!found){
+        BOOST_LOG_TRIVIAL(debug) << "file not found";
+        // resolved before the filename is bound, directory creation reuses no file buffers
+        m_bound_directory_id = find_or_create_directory(record.m_directory);
+        m_bound_extension_id = find_or_create_extension(record.m_extension);
+        m_bound_filename.assign(record.m_filename.data(), record.m_filename.size());
+
+        BOOST_LOG_TRIVIAL(debug) << "inserting file into database";
+        m_insert_file.execute(true);
+        long long id = 0;
+        m_sql.get_last_insert_id("files", id);
+        m_new_names.emplace_back(static_cast<int>(id), record.m_filename);
+        return true;
+    }
+    BOOST_LOG_TRIVIAL(debug) << "found current file with id " << m_bound_file_id << " in database";
+    m_update_file.execute(true);
+    return false;
+}
+
+bool index_writer::find_file(string_view directory, string_view filename, int& file_id){
+    auto it = m_directory_ids.find(directory);
+    if(it != m_directory_ids.end()){
+        m_bound_directory_id = it->second;
+    } else{
+        m_bound_path.assign(directory.data(), directory.size());
+        if(!m_select_directory.execute(true)){
+            return false;
+        }
+    }
+    m_bound_filename.assign(filename.data(), filename.size());
+    if(!m_select_file.execute(true)){
+        return false;
+    }
+    file_id = m_bound_file_id;
+    return true;
+}
+
+void index_writer::remove(const std::vector<int>& ids){
+    if(ids.empty()){
+        return;
+    }
+    try {
+        BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
+        m_sql << "BEGIN TRANSACTION;";
+        // Collected first and deleted by one statement: a statement firing the files_names trigger
+        // makes FTS5 flush its pending terms, so deleting row by row writes a segment per file.
+        m_sql << "CREATE TEMP TABLE IF NOT EXISTS `removed_files`(id INTEGER PRIMARY KEY);";
+        int file_id;
+        statement insert_id = (m_sql.prepare << "INSERT OR IGNORE INTO temp.`removed_files`(id) VALUES (:id);",
+                use(file_id, "id"));
+        for (int id : ids) {
+            file_id = id;
+            insert_id.execute(true);
+        }
+        // ids given twice or already gone are not counted
+        statement delete_files = (m_sql.prepare << "DELETE FROM `files` WHERE id IN (SELECT id FROM temp.`removed_files`);");
+        delete_files.execute(true);
+        const auto deleted = static_cast<std::size_t>(delete_files.get_affected_rows());
+        m_sql << "DELETE FROM temp.`removed_files`;";
+        BOOST_LOG_TRIVIAL(debug) << "committing transaction";
+        m_sql << "COMMIT;";
+        m_removed_count += deleted;
+        add_metric(get_metrics().m_rows_deleted, deleted);
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(info) << "rolling back";
+        m_sql << "ROLLBACK;";
+        BOOST_LOG_TRIVIAL(error) << "error while deleting removed files: " << err.what();
+    }
+}
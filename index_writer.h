@@ -0,0 +1,135 @@
+#ifndef OS_COURSE_WORK_INDEX_WRITER_H
+#define OS_COURSE_WORK_INDEX_WRITER_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <soci/soci.h>
+
+#include "string_pool.h"
+
+class index_state;
+
+// One file seen by the walker, ready to be written to the database.
+// The strings are views into a pool shared by the records of one directory, the directory is stored once
+// and the extension is a suffix of the filename.
+struct file_record{
+    std::string_view m_directory;
+    std::string_view m_filename;
+    std::string_view m_extension;
+    std::shared_ptr<const string_pool> m_strings;
+    off_t m_size = 0;
+    timespec m_last_changed{};
+    // XXH64 of the content, only set in hashing mode
+    long long m_content_hash = 0;
+    bool m_hashed = false;
+};
+
+// Accumulates file records and writes them to the database in batches,
+// one transaction per batch instead of one per file.
+// A batch is flushed when it reaches `batch_size` records or when it is older than `batch_interval`.
+// With an index state (incremental mode) unchanged files are skipped
+// and known files are updated by id without looking them up first.
+// Every written row is stamped with the generation of the current scan.
+// The per-file statements are prepared once and re-executed with bound member buffers,
+// directory and extension ids are resolved through in-memory maps, so the hot path parses no SQL.
+class index_writer{
+public:
+    index_writer(soci::session& sql, std::size_t batch_size, std::chrono::milliseconds batch_interval,
+                 long long scan_generation, index_state* state = nullptr);
+    ~index_writer();
+
+    index_writer(const index_writer&) = delete;
+    index_writer& operator=(const index_writer&) = delete;
+
+    void add(file_record record);
+    void flush();
+    // flushes the current batch if it is older than the batch interval
+    void flush_expired();
+    // looks up the id of an indexed file without creating its directory
+    bool find_file(std::string_view directory, std::string_view filename, int& file_id);
+    // deletes files by id in one transaction
+    void remove(const std::vector<int>& ids);
+    // drops cached directory ids, must be called after directories were deleted behind the writer's back
+    void forget_directories();
+
+    std::size_t inserted_count() const { return m_inserted_count; }
+    std::size_t updated_count() const { return m_updated_count; }
+    std::size_t unchanged_count() const { return m_unchanged_count; }
+    std::size_t removed_count() const { return m_removed_count; }
+    std::size_t failed_count() const { return m_failed_count; }
+    long long scan_generation() const { return m_scan_generation; }
+
+private:
+    // writes all records in one transaction, rolls back the whole batch on error
+    bool write_batch();
+    // fallback after a failed batch: every record in its own transaction
+    void write_batch_by_one();
+    // returns true if the file was inserted, false if updated
+    bool write_record(const file_record& record);
+    // resolves the id of a directory, creating it and its missing ancestors
+    int find_or_create_directory(std::string_view path);
+    int find_or_create_extension(std::string_view ext);
+    void load_extensions();
+    // Indexes the names of the files inserted by the current transaction.
+    // FTS5 flushes its pending terms whenever a statement with triggers runs, like every write to `files`,
+    // so the names go last and are flushed once at commit instead of once per file.
+    void write_new_names();
+    // drops ids created by a transaction that was rolled back
+    void forget_uncommitted();
+
+    soci::session& m_sql;
+    std::size_t m_batch_size;
+    std::chrono::milliseconds m_batch_interval;
+    std::vector<file_record> m_batch;
+    std::chrono::steady_clock::time_point m_batch_started;
+    long long m_scan_generation;
+    index_state* m_state;
+    // directory ids are resolved once per run, extension ids are preloaded,
+    // ids created by a transaction are dropped if it rolls back;
+    // the keys are views into the pools, so looking up the view of a record allocates nothing
+    string_pool m_directory_keys;
+    std::unordered_map<std::string_view, int> m_directory_ids;
+    std::vector<std::string_view> m_uncommitted_directories;
+    string_pool m_extension_keys;
+    std::unordered_map<std::string_view, int> m_extension_ids;
+    std::vector<std::string_view> m_uncommitted_extensions;
+    // files inserted by the current transaction whose names are not indexed yet, views into the batch's records
+    std::vector<std::pair<int, std::string_view>> m_new_names;
+
+    // buffers bound to the prepared statements below, must be declared before them
+    int m_bound_file_id = 0;
+    int m_bound_directory_id = 0;
+    int m_bound_parent_id = 0;
+    soci::indicator m_bound_parent_indicator = soci::i_null;
+    int m_bound_extension_id = 0;
+    std::string m_bound_path;
+    std::string m_bound_filename;
+    long long m_bound_size = 0;
+    long long m_bound_last_changed = 0;
+    long long m_bound_hash = 0;
+    soci::indicator m_bound_hash_indicator = soci::i_null;
+
+    soci::statement m_select_file;
+    soci::statement m_insert_file;
+    soci::statement m_update_file;
+    soci::statement m_insert_file_name;
+    soci::statement m_select_directory;
+    soci::statement m_insert_directory;
+
+    std::size_t m_inserted_count = 0;
+    std::size_t m_updated_count = 0;
+    std::size_t m_unchanged_count = 0;
+    std::size_t m_removed_count = 0;
+    std::size_t m_failed_count = 0;
+};
+
+#endif //OS_COURSE_WORK_INDEX_WRITER_H
@@ -2,12 +2,27 @@
 #error "Not for windows"
 #endif
 
+#include <algorithm>
+#include <deque>
+#include <cerrno>
+#include <cstdint>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <regex>
 #include <utility>
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <functional>
 #include <chrono>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include <soci/boost-optional.h>
 #include <soci/boost-tuple.h>
@@ -24,8 +39,23 @@
 #include <soci/soci.h>
 #include <soci/sqlite3/soci-sqlite3.h>
 
-#include <ftw.h>
+#include "content_hash.h"
+#include "database.h"
+#include "helpers.h"
+#include "index_state.h"
+#include "index_writer.h"
+#include "metrics.h"
+#include "result_writer.h"
+#include "server.h"
+#include "shards.h"
+#include "snapshot.h"
+#include "walk_filter.h"
+#include "walker.h"
+#include "watcher.h"
+
 #include <sys/stat.h>
+#include <signal.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <libgen.h>
 
@@ -44,23 +74,12 @@ using std::endl;
 using std::string;
 using std::vector;
 
-const vector<string> create_database_queries = {"CREATE TABLE IF NOT EXISTS `extensions` ("
-                                            "    `id` INTEGER PRIMARY KEY AUTOINCREMENT,"
-                                            "    `extension` TEXT NOT NULL UNIQUE"
-                                            ");",
-                                            "CREATE TABLE IF NOT EXISTS `files`("
-                                            "    `id` INTEGER PRIMARY KEY AUTOINCREMENT,"
-                                            "    `directory` TEXT NOT NULL,"
-                                            "    `filename` TEXT NOT NULL,"
-                                            "    `file_size` INTEGER NOT NULL DEFAULT 0,"
-                                            "    `last_changed_at` TEXT NOT NULL," // this is a datetime
-                                            "    `extension_id` INTEGER NOT NULL,"
-                                            "    foreign key (`extension_id`) REFERENCES `extensions`(`id`)"
-                                            " ON DELETE CASCADE ON UPDATE CASCADE"
-                                            ");"};
-
-static const int max_file_descriptors_count = 256;
-static const int stat_ext_sql_limit = 10;
+static const std::size_t walk_queue_batches = 1024;
+static const std::chrono::milliseconds writer_poll_interval{100};
+static const std::chrono::milliseconds watch_idle_interval{1000};
+static const unsigned max_shards = 256;
+// rows a shard search collects before it takes the lock of the result writer
+static const std::size_t search_chunk_files = 256;
 
 struct command{
     explicit command(string  name): m_name(std::move(name)){}
@@ -80,7 +99,7 @@ void validate(boost::any& v,
 
     string const& s = validators::get_single_string(values);
 
-    if(s == "index" || s == "search" || s == "stat"){
+    if(s == "index" || s == "search" || s == "stat" || s == "watch" || s == "dupes" || s == "serve" || s == "export"){
         v = boost::any(command(s));
     } else{
         throw validation_error(validation_error::invalid_option_value);
@@ -92,17 +111,6 @@ void init_logging() {
     logging::core::get()->set_filter(logging::trivial::severity > logging::trivial::info);
 }
 
-void create_database(session &sql) {
-    for (const auto &query : create_database_queries) {
-        BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
-        sql << "BEGIN TRANSACTION;";
-        BOOST_LOG_TRIVIAL(trace) << "executing query: " << query;
-        sql << query;
-        BOOST_LOG_TRIVIAL(debug) << "committing transaction";
-        sql << "COMMIT";
-    }
-}
-
 bool path_exists(const string& str){
     struct stat s;
     int err = stat(str.c_str(), &s);
@@ -153,234 +161,308 @@ void printUsage(const std::string &argv0, const po::positional_options_descripti
     os << desc << std::endl;
 }
 
-session& get_sql_instance(){
-    static session sql;
-    BOOST_LOG_TRIVIAL(trace) << "get sql instance";
-    return sql;
-}
-
-// Returns number of days since civil 1970-01-01.  Negative values indicate
-//    days prior to 1970-01-01.
-// Preconditions:  y-m-d represents a date in the civil (Gregorian) calendar
-//                 m is in [1, 12]
-//                 d is in [1, last_day_of_month(y, m)]
-//                 y is "approximately" in
-//                   [numeric_limits<Int>::min()/366, numeric_limits<Int>::max()/366]
-//                 Exact range of validity is:
-//                 [civil_from_days(numeric_limits<Int>::min()),
-//                  civil_from_days(numeric_limits<Int>::max()-719468)]
-template <class Int>
-constexpr
-Int
-days_from_civil(Int y, unsigned m, unsigned d) noexcept
-{
-    static_assert(std::numeric_limits<unsigned>::digits >= 18,
-                  "This algorithm has not been ported to a 16 bit unsigned integer");
-    static_assert(std::numeric_limits<Int>::digits >= 20,
-                  "This algorithm has not been ported to a 16 bit signed integer");
-    y -= m <= 2;
-    const Int era = (y >= 0 ? y : y-399) / 400;
-    const unsigned yoe = static_cast<unsigned>(y - era * 400);      // [0, 399]
-    const unsigned doy = (153*(m + (m > 2 ? -3 : 9)) + 2)/5 + d-1;  // [0, 365]
-    const unsigned doe = yoe * 365 + yoe/4 - yoe/100 + doy;         // [0, 146096]
-    return era * 146097 + static_cast<Int>(doe) - 719468;
-}
-
-// Returns year/month/day triple in civil calendar
-// Preconditions:  z is number of days since 1970-01-01 and is in the range:
-//                   [numeric_limits<Int>::min(), numeric_limits<Int>::max()-719468].
-template <class Int>
-constexpr
-std::tuple<Int, unsigned, unsigned>
-civil_from_days(Int z) noexcept
-{
-    static_assert(std::numeric_limits<unsigned>::digits >= 18,
-                  "This algorithm has not been ported to a 16 bit unsigned integer");
-    static_assert(std::numeric_limits<Int>::digits >= 20,
-                  "This algorithm has not been ported to a 16 bit signed integer");
-    z += 719468;
-    const Int era = (z >= 0 ? z : z - 146096) / 146097;
-    const auto doe = static_cast<unsigned>(z - era * 146097);          // [0, 146096]
-    const unsigned yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;  // [0, 399]
-    const Int y = static_cast<Int>(yoe) + era * 400;
-    const unsigned doy = doe - (365*yoe + yoe/4 - yoe/100);                // [0, 365]
-    const unsigned mp = (5*doy + 2)/153;                                   // [0, 11]
-    const unsigned d = doy - (153*mp+2)/5 + 1;                             // [1, 31]
-    const unsigned m = mp + (mp < 10 ? 3 : -9);                            // [1, 12]
-    return std::tuple<Int, unsigned, unsigned>(y + (m <= 2), m, d);
-}
-
-template <class Int>
-constexpr
-unsigned
-weekday_from_days(Int z) noexcept
-{
-    return static_cast<unsigned>(z >= -4 ? (z+4) % 7 : (z+5) % 7 + 6);
+// one session per shard file, a database that is not sharded is the only shard
+vector<std::unique_ptr<session>>& get_shard_instances(){
+    static vector<std::unique_ptr<session>> shards;
+    return shards;
 }
 
-template <class To, class Rep, class Period>
-To
-round_down(const std::chrono::duration<Rep, Period>& d)
-{
-    To t = std::chrono::duration_cast<To>(d);
-    if (t > d)
-        --t;
-    return t;
+vector<session*> get_shards(){
+    vector<session*> shards;
+    for (auto &shard : get_shard_instances()) {
+        shards.push_back(shard.get());
+    }
+    return shards;
 }
 
-template <class Duration>
-std::tm
-make_utc_tm(std::chrono::time_point<std::chrono::system_clock, Duration> tp)
-{
-    using namespace std;
-    using namespace std::chrono;
-    typedef duration<int, ratio_multiply<hours::period, ratio<24>>> days;
-    // t is time duration since 1970-01-01
-    Duration t = tp.time_since_epoch();
-    // d is days since 1970-01-01
-    days d = round_down<days>(t);
-    // t is now time duration since midnight of day d
-    t -= d;
-    // break d down into year/month/day
-    int year;
-    unsigned month;
-    unsigned day;
-    std::tie(year, month, day) = civil_from_days(d.count());
-    // start filling in the tm with calendar info
-    std::tm tm = {0};
-    tm.tm_year = year - 1900;
-    tm.tm_mon = month - 1;
-    tm.tm_mday = day;
-    tm.tm_wday = weekday_from_days(d.count());
-    tm.tm_yday = d.count() - days_from_civil(year, 1, 1);
-    // Fill in the time
-    tm.tm_hour = duration_cast<hours>(t).count();
-    t -= hours(tm.tm_hour);
-    tm.tm_min = duration_cast<minutes>(t).count();
-    t -= minutes(tm.tm_min);
-    tm.tm_sec = duration_cast<seconds>(t).count();
-    return tm;
-}
-
-void index_file(const string& path, const struct stat* sb){
-    session &sql = get_sql_instance();
-    BOOST_LOG_TRIVIAL(debug) << "indexing file " << path;
-    string base_name(basename((char*)path.c_str())), dir_name(dirname((char*)path.c_str()));
-    off_t filesize = sb->st_size;
-    timespec last_changed = sb->st_mtim;
+session& get_sql_instance(){
+    BOOST_LOG_TRIVIAL(trace) << "get sql instance";
+    return *get_shard_instances().front();
+}
 
-    std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> tp;
-    {
-        using namespace std::chrono;
-        auto d = seconds{last_changed.tv_sec} + nanoseconds{last_changed.tv_nsec};
-        decltype(tp) temp_tp{duration_cast<system_clock::duration>(d)};
-        tp = temp_tp;
+// drops duplicate roots and roots that lie inside another root, so no file is walked twice
+vector<string> remove_nested_roots(vector<string> roots){
+    std::sort(roots.begin(), roots.end());
+    vector<string> result;
+    for (auto &root : roots) {
+        if(!result.empty()){
+            const auto bounds = subtree_bounds(result.back());
+            if(root == result.back() || (root >= bounds.first && root < bounds.second)){
+                BOOST_LOG_TRIVIAL(debug) << "path " << root << " is already indexed as part of " << result.back();
+                continue;
+            }
+        }
+        result.push_back(std::move(root));
     }
-    std::tm last_changed_tm = make_utc_tm(tp);
+    return result;
+}
 
-    try {
+// starts a new scan, returns its generation number
+long long begin_scan(session& sql){
+    sql << "INSERT INTO `scans`(started_at) VALUES (datetime('now'));";
+    long long generation = 0;
+    sql << "SELECT MAX(id) FROM `scans`;", into(generation);
+    BOOST_LOG_TRIVIAL(debug) << "started scan generation " << generation;
+    return generation;
+}
+
+// Deletes rows under the walked roots that were not stamped by this scan, so they no longer exist.
+// One set-based DELETE per root, files outside of the roots are not touched.
+std::size_t remove_stale_files(session& sql, const vector<string>& roots, long long generation){
+    std::size_t removed = 0;
+    try{
         BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
         sql << "BEGIN TRANSACTION;";
-
-        BOOST_LOG_TRIVIAL(debug) << "selecting file";
-
-        rowset<row> rs = (sql.prepare << "SELECT id FROM `files` WHERE filename = :filename AND directory = :directory;",
-                use( base_name, "filename"), use(dir_name, "directory"));
-        const auto& iter_rs = rs.begin();
-        if(iter_rs == rs.end()){
-            BOOST_LOG_TRIVIAL(debug) << "file not found";
-            const auto cxx_path = fs::path(path);
-            string ext = cxx_path.has_extension() ? cxx_path.extension() : "";
-            
-            // find out extension id
-            BOOST_LOG_TRIVIAL(debug) << "finding extension id";
-            boost::optional<int> extension_id;
-            BOOST_LOG_TRIVIAL(trace) << "selecting extension from db";
-            sql << "SELECT id FROM `extensions` WHERE extension=:ext ;", into(extension_id), use( ext, "ext");
-            if(!extension_id.is_initialized()){
-                BOOST_LOG_TRIVIAL(trace) << "extension not found. creating new extension";
-                sql << "INSERT INTO `extensions`(extension) VALUES (:ext);", use( ext);
-                BOOST_LOG_TRIVIAL(debug) << "committing";
-                sql << "COMMIT;";
-                BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
-                sql << "BEGIN TRANSACTION;";
-                BOOST_LOG_TRIVIAL(trace) << "selecting extension from db";
-                sql << "SELECT id FROM `extensions` WHERE extension=:ext ;", use( ext), into(extension_id);
-            }
-            assert(extension_id.is_initialized() && "Something went wrong with sql logic");
-
-            // insert file
-            BOOST_LOG_TRIVIAL(info) << "inserting file into database";
-            sql << "INSERT INTO `files`(directory, filename, file_size, last_changed_at, extension_id) "
-                   "VALUES (?, ?, ?, ?, ?);", use(dir_name), use(base_name), use(filesize), use(last_changed_tm), use(extension_id);
-        } else{
-            int file_id = iter_rs->get<int>(0); // id
-            BOOST_LOG_TRIVIAL(debug) << "found current file with id " << file_id << " in database";
-            BOOST_LOG_TRIVIAL(debug) << "updating database info";
-            sql << "UPDATE `files` SET "
-                   "file_size = :size ,"
-                   "last_changed_at = :changed "
-                   "WHERE id = :id ;", use(filesize, "size"),
-                   use(last_changed_tm, "changed"),
-                   use(file_id, "id");
-        }
-
-        BOOST_LOG_TRIVIAL(debug) << "committing";
-        sql << "COMMIT;";
-    } catch (std::exception& err){
+        for (const auto &root : roots) {
+            const auto bounds = subtree_bounds(root);
+            statement st = (sql.prepare << "DELETE FROM `files` WHERE scan_generation < :generation AND directory_id IN ("
+                                           "SELECT id FROM `directories` "
+                                           "WHERE path = :dir OR (path >= :lower AND path < :upper));",
+                    use(generation, "generation"), use(root, "dir"),
+                    use(bounds.first, "lower"), use(bounds.second, "upper"));
+            st.execute(true);
+            removed += st.get_affected_rows();
+        }
+        BOOST_LOG_TRIVIAL(debug) << "committing transaction";
+        sql << "COMMIT";
+        add_metric(get_metrics().m_rows_deleted, removed);
+    } catch (const std::exception& err){
         BOOST_LOG_TRIVIAL(info) << "rolling back";
         sql << "ROLLBACK;";
-        BOOST_LOG_TRIVIAL(error) << "Error occurred: " << err.what();
+        BOOST_LOG_TRIVIAL(error) << "error while deleting stale files: " << err.what();
+        removed = 0;
     }
-
+    return removed;
 }
 
-//FTW_F - file
-//FTW_D - dir
-//FTW_DNR - dir without permissions to read
-//FTW_NS - stat call failed
-
-int handle_walk(const char* fpath, const struct stat* sb, int typeflag){
-    if(typeflag == FTW_D){
-        BOOST_LOG_TRIVIAL(trace) << "got directory: " << fpath;
-        return 0;
-    }
-    if(typeflag == FTW_F) {
-        BOOST_LOG_TRIVIAL(trace) << "got file: " << fpath;
-        string path = fpath;
-        index_file(path, sb);
-    }
-    else{
-        BOOST_LOG_TRIVIAL(error) << "got unexpected flag: " << typeflag;
+// Deletes directories under the roots that have neither files nor subdirectories left,
+// one level of leaves per pass until nothing changes.
+void remove_empty_directories(session& sql, const vector<string>& roots){
+    try{
+        BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
+        sql << "BEGIN TRANSACTION;";
+        for (const auto &root : roots) {
+            const auto bounds = subtree_bounds(root);
+            statement st = (sql.prepare << "DELETE FROM `directories` "
+                                           "WHERE (path = :dir OR (path >= :lower AND path < :upper)) "
+                                           "AND NOT EXISTS (SELECT 1 FROM `files` f WHERE f.directory_id = directories.id) "
+                                           "AND NOT EXISTS (SELECT 1 FROM `directories` c WHERE c.parent_id = directories.id);",
+                    use(root, "dir"), use(bounds.first, "lower"), use(bounds.second, "upper"));
+            do {
+                st.execute(true);
+            } while(st.get_affected_rows() > 0);
+        }
+        BOOST_LOG_TRIVIAL(debug) << "committing transaction";
+        sql << "COMMIT";
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(info) << "rolling back";
+        sql << "ROLLBACK;";
+        BOOST_LOG_TRIVIAL(error) << "error while deleting empty directories: " << err.what();
     }
-    return 0;
 }
 
-void index_files(const po::variables_map& vm){
+// what one indexing run changed
+struct index_result{
+    std::size_t m_inserted = 0;
+    std::size_t m_updated = 0;
+    std::size_t m_removed = 0;
+    std::size_t m_unchanged = 0;
+    std::size_t m_failed = 0;
+};
+
+vector<string> resolve_roots(const po::variables_map& vm){
     const auto &paths = vm["index-path"].as<vector<string>>();
+    vector<string> roots;
     for (const auto &path : paths) {
-        char *rpath = new char[PATH_MAX];
+        char rpath[PATH_MAX];
         if(realpath(path.c_str(), rpath) == nullptr){
             BOOST_LOG_TRIVIAL(error) << "invalid path: " << path.c_str();
-            delete[] rpath;
             continue;
         }
-        string real_path = rpath;
-        BOOST_LOG_TRIVIAL(debug) << "indexing path: " << real_path;
-        ftw(real_path.c_str(), handle_walk, max_file_descriptors_count);
+        BOOST_LOG_TRIVIAL(debug) << "indexing path: " << rpath;
+        roots.emplace_back(rpath);
     }
+    return remove_nested_roots(std::move(roots));
+}
 
-    // filter deleted files
-    session &sql = get_sql_instance();
+// pops walked batches into the writer until the walk is over
+void write_walked_files(index_writer& writer, record_queue& queue){
+    vector<file_record> batch;
+    while(true){
+        bool popped;
+        {
+            metrics_timer timer(get_metrics().m_writer_idle_ns);
+            popped = queue.pop(batch, writer_poll_interval);
+        }
+        if(popped){
+            for (auto &record : batch) {
+                writer.add(std::move(record));
+            }
+        } else if(queue.closed_and_empty()){
+            break;
+        }
+        writer.flush_expired();
+    }
+    writer.flush();
+}
+
+// A root is kept whole in the shard it hashes to, files an earlier run put under it in another shard,
+// e.g. as part of a parent root, are deleted there so no file is in two shards.
+void remove_roots_from_other_shards(const vector<session*>& shards, const shard_router& router,
+                                    const vector<string>& roots){
+    run_on_shards(router.count(), [&](unsigned shard){
+        vector<string> moved;
+        for (const auto &root : roots) {
+            if(router.shard_of_root(root) != shard){
+                moved.push_back(root);
+            }
+        }
+        const auto removed = remove_stale_files(*shards[shard], moved, std::numeric_limits<long long>::max());
+        remove_empty_directories(*shards[shard], moved);
+        if(removed != 0){
+            BOOST_LOG_TRIVIAL(info) << "moved " << removed << " files out of shard " << shard;
+        }
+    });
+}
+
+// Walks the roots and brings their part of the index up to date, files the filter skips are removed from it.
+// One walker feeds every shard, each shard has its own writer thread when there is more than one.
+// Every shard starts a new scan unless `generation` is given, watch stamps all its rescans with one.
+index_result index_roots(const vector<session*>& shards, const shard_layout& layout, const vector<string>& roots,
+                         const walk_filter& filter, const po::variables_map& vm, bool incremental,
+                         long long generation = 0){
+    const bool hash = vm["hash"].as<bool>();
+    const shard_router router(layout, roots);
+    if(layout.m_count > 1 && layout.m_by == shard_by::root){
+        remove_roots_from_other_shards(shards, router, roots);
+    }
+    // hashing without --incremental still needs the known hashes to skip unchanged files
+    index_state state;
+    if(incremental || hash){
+        for (unsigned shard = 0; shard < shards.size(); ++shard) {
+            state.load(*shards[shard], roots, shard);
+        }
+    }
+
+    // walker threads only produce records, each shard is written by one thread
+    vector<long long> generations;
+    vector<std::unique_ptr<index_writer>> writers;
+    for (auto *sql : shards) {
+        generations.push_back(generation != 0 ? generation : begin_scan(*sql));
+        writers.push_back(std::make_unique<index_writer>(*sql, vm["batch-size"].as<std::size_t>(),
+                                                         std::chrono::milliseconds(vm["batch-ms"].as<long>()),
+                                                         generations.back(), incremental ? &state : nullptr));
+    }
+    record_queue queue(walk_queue_batches);
+    parallel_walker walker(roots, vm["jobs"].as<unsigned>(), queue);
+    walker.set_filter(filter);
+    if(hash){
+        walker.enable_hashing(&state);
+    }
+    if(vm["io-uring"].as<bool>() && !walker.enable_io_uring()){
+        BOOST_LOG_TRIVIAL(warning) << "io_uring with statx is not available, files are stat'ed one call at a time";
+    }
+    walker.start();
+    if(shards.size() == 1){
+        write_walked_files(*writers.front(), queue);
+    } else{
+        vector<std::unique_ptr<record_queue>> shard_queues;
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            shard_queues.push_back(std::make_unique<record_queue>(walk_queue_batches));
+        }
+        std::thread writer_threads([&]{
+            run_on_shards(router.count(), [&](unsigned shard){
+                write_walked_files(*writers[shard], *shard_queues[shard]);
+            });
+        });
+        // a batch holds the files of one directory and goes to one shard, only the batch of file roots is split
+        vector<file_record> batch;
+        vector<vector<file_record>> parts(shards.size());
+        while(true){
+            if(queue.pop(batch, writer_poll_interval)){
+                for (auto &record : batch) {
+                    parts[router.shard_of(record)].push_back(std::move(record));
+                }
+                for (std::size_t i = 0; i < parts.size(); ++i) {
+                    if(!parts[i].empty()){
+                        shard_queues[i]->push(std::move(parts[i]));
+                        parts[i].clear();
+                    }
+                }
+            } else if(queue.closed_and_empty()){
+                break;
+            }
+        }
+        for (auto &shard_queue : shard_queues) {
+            shard_queue->close();
+        }
+        writer_threads.join();
+    }
+    walker.join();
+
+    // filter deleted files, unchanged files are not stamped in incremental mode so the diff is used there
+    vector<std::size_t> removed(shards.size());
+    run_on_shards(router.count(), [&](unsigned shard){
+        if(incremental){
+            writers[shard]->remove(state.unseen_ids(shard));
+            removed[shard] = writers[shard]->removed_count();
+        } else{
+            removed[shard] = remove_stale_files(*shards[shard], roots, generations[shard]);
+        }
+        remove_empty_directories(*shards[shard], roots);
+    });
+
+    index_result result;
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        result.m_removed += removed[i];
+        result.m_inserted += writers[i]->inserted_count();
+        result.m_updated += writers[i]->updated_count();
+        result.m_unchanged += writers[i]->unchanged_count();
+        result.m_failed += writers[i]->failed_count();
+    }
+    return result;
+}
+
+void print_index_result(std::ostream& out, const index_result& result, bool incremental){
+    out << "Added files: " << result.m_inserted << endl;
+    out << "Updated files: " << result.m_updated << endl;
+    out << "Removed files: " << result.m_removed << endl;
+    if(incremental){
+        out << "Unchanged files: " << result.m_unchanged << endl;
+    }
+    if(result.m_failed != 0){
+        out << "Failed files: " << result.m_failed << endl;
+    }
+}
+
+// Deletes each directory and then its ancestors while they have neither files nor subdirectories left,
+// nothing above the roots is touched.
+void remove_empty_parents(session& sql, const vector<string>& roots, const vector<string>& directories){
+    auto in_roots = [&roots](const string& path){
+        for (const auto &root : roots) {
+            const auto bounds = subtree_bounds(root);
+            if(path == root || (path >= bounds.first && path < bounds.second)){
+                return true;
+            }
+        }
+        return false;
+    };
+    string path;
     try{
-        rowset<row> rs = (sql.prepare << "SELECT * FROM `files`;");
         BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
         sql << "BEGIN TRANSACTION;";
-        for (const auto &item : rs) {
-            const auto &full_path = item.get<string>(1) + "/" + item.get<string>(2);
-            if (!path_exists(full_path)) {
-                BOOST_LOG_TRIVIAL(info) << "deleting path: " << std::quoted(full_path);
-                sql << "DELETE FROM `files` WHERE id=:id ;", use(item.get<int>(0), "id");
+        statement st = (sql.prepare << "DELETE FROM `directories` WHERE path = :path "
+                                       "AND NOT EXISTS (SELECT 1 FROM `files` f WHERE f.directory_id = directories.id) "
+                                       "AND NOT EXISTS (SELECT 1 FROM `directories` c WHERE c.parent_id = directories.id);",
+                use(path, "path"));
+        for (const auto &directory : directories) {
+            path = directory;
+            while(in_roots(path)){
+                st.execute(true);
+                if(st.get_affected_rows() == 0 || path == "/"){
+                    break;
+                }
+                path = fs::path(path).parent_path().string();
             }
         }
         BOOST_LOG_TRIVIAL(debug) << "committing transaction";
@@ -388,82 +470,1100 @@ void index_files(const po::variables_map& vm){
     } catch (const std::exception& err){
         BOOST_LOG_TRIVIAL(info) << "rolling back";
         sql << "ROLLBACK;";
-        BOOST_LOG_TRIVIAL(error) << "error while walking through all rows: " << err.what();
+        BOOST_LOG_TRIVIAL(error) << "error while deleting empty directories: " << err.what();
     }
 }
 
-void search_files(const po::variables_map& vm){
-    session& sql = get_sql_instance();
+bool read_walk_filter(const po::variables_map& vm, const vector<string>& roots, walk_filter& filter){
+    filter = walk_filter(roots);
+    for (const auto &pattern : vm["exclude"].as<vector<string>>()) {
+        if(!filter.add_exclude(pattern)){
+            cout << "Invalid pattern: " << pattern << endl;
+            return false;
+        }
+    }
+    for (const auto &pattern : vm["include"].as<vector<string>>()) {
+        if(!filter.add_include(pattern)){
+            cout << "Invalid pattern: " << pattern << endl;
+            return false;
+        }
+    }
+    for (const auto &extensions : vm["extension"].as<vector<string>>()) {
+        std::size_t begin = 0;
+        while(begin <= extensions.size()){
+            auto end = extensions.find(',', begin);
+            if(end == string::npos){
+                end = extensions.size();
+            }
+            if(end != begin){
+                filter.add_extension(extensions.substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+    }
+    if(vm.count("ignore-file")){
+        try{
+            filter.load_ignore_file(vm["ignore-file"].as<string>());
+        } catch (const std::exception& err){
+            cout << err.what() << endl;
+            return false;
+        }
+    }
+    filter.set_max_depth(vm["max-depth"].as<int>());
+    filter.set_one_file_system(vm["one-file-system"].as<bool>());
+    return true;
+}
 
+bool check_report_options(const po::variables_map& vm){
+    const auto &progress = vm["progress"].as<string>();
+    if(progress != "auto" && progress != "always" && progress != "never"){
+        cout << "Invalid argument: " << progress << endl;
+        return false;
+    }
+    const auto &format = vm["metrics-format"].as<string>();
+    if(format != "prometheus" && format != "json"){
+        cout << "Invalid argument: " << format << endl;
+        return false;
+    }
+    return true;
+}
+
+// progress line of a long run, by default only when stderr is a terminal
+std::unique_ptr<progress_reporter> start_progress(const po::variables_map& vm){
+    const auto &mode = vm["progress"].as<string>();
+    const auto interval = std::chrono::milliseconds(vm["progress-ms"].as<long>());
+    if(mode == "never" || interval.count() <= 0 || (mode == "auto" && !isatty(STDERR_FILENO))){
+        return nullptr;
+    }
+    return std::make_unique<progress_reporter>(interval);
+}
+
+void dump_metrics(const po::variables_map& vm){
+    if(vm.count("metrics-file")){
+        write_metrics(vm["metrics-file"].as<string>(), vm["metrics-format"].as<string>());
+    }
+}
+
+void index_files(const po::variables_map& vm, const shard_layout& layout){
+    if(!check_report_options(vm)){
+        return;
+    }
+    const auto roots = resolve_roots(vm);
+    walk_filter filter;
+    if(!read_walk_filter(vm, roots, filter)){
+        return;
+    }
+    const bool incremental = vm["incremental"].as<bool>();
+    auto progress = start_progress(vm);
+    const auto result = index_roots(get_shards(), layout, roots, filter, vm, incremental);
+    if(progress){
+        progress->stop();
+    }
+    print_index_result(cout, result, incremental);
+    dump_metrics(vm);
+}
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+extern "C" void request_stop(int){
+    stop_requested = 1;
+}
+
+// Writes coalesced watch events to the index.
+// Subtrees are rescanned incrementally, other paths are stat'ed again and written through the long-lived writer,
+// paths that no longer exist are deleted.
+index_result apply_watch_changes(session& sql, index_writer& writer, const vector<string>& roots,
+                                 const walk_filter& filter, const watch_changes& changes,
+                                 const po::variables_map& vm){
+    index_result result;
+    const auto subtrees = remove_nested_roots(vector<string>(changes.m_subtrees.begin(), changes.m_subtrees.end()));
+    auto in_subtree = [&subtrees](const string& path){
+        for (const auto &subtree : subtrees) {
+            const auto bounds = subtree_bounds(subtree);
+            if(path == subtree || (path >= bounds.first && path < bounds.second)){
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // deleted paths, parents of deleted paths are pruned if they are left empty
+    vector<std::pair<string, string>> deleted;
+    vector<string> existing_subtrees, vanished_subtrees;
+    for (const auto &subtree : subtrees) {
+        struct stat sb;
+        if(stat(subtree.c_str(), &sb) == 0){
+            existing_subtrees.push_back(subtree);
+            continue;
+        }
+        const auto cxx_path = fs::path(subtree);
+        deleted.emplace_back(cxx_path.parent_path().string(), cxx_path.filename().string());
+        // every generation is older than this one, the whole subtree goes
+        result.m_removed += remove_stale_files(sql, {subtree}, std::numeric_limits<long long>::max());
+        vanished_subtrees.push_back(subtree);
+    }
+    remove_empty_directories(sql, vanished_subtrees);
+    if(!existing_subtrees.empty()){
+        // the session's generation is reused, a scan row per burst of events would pile up
+        const index_result rescan = index_roots({&sql}, shard_layout(), existing_subtrees, filter, vm, true,
+                                                writer.scan_generation());
+        result.m_inserted += rescan.m_inserted;
+        result.m_updated += rescan.m_updated;
+        result.m_removed += rescan.m_removed;
+        result.m_failed += rescan.m_failed;
+    }
+
+    const std::size_t inserted = writer.inserted_count(), updated = writer.updated_count(),
+            removed = writer.removed_count(), failed = writer.failed_count();
+    for (const auto &path : changes.m_files) {
+        if(in_subtree(path)){
+            continue;
+        }
+        const auto cxx_path = fs::path(path);
+        struct stat sb;
+        if(stat(path.c_str(), &sb) == 0){
+            if(!S_ISDIR(sb.st_mode)){
+                std::uint64_t hash;
+                struct stat hashed;
+                if(vm["hash"].as<bool>() && hash_file_at(AT_FDCWD, path.c_str(), UINT64_MAX, hash, hashed)){
+                    auto record = make_file_record(cxx_path.parent_path().string(), cxx_path.filename().string(), hashed);
+                    record.m_content_hash = static_cast<long long>(hash);
+                    record.m_hashed = true;
+                    writer.add(std::move(record));
+                } else{
+                    writer.add(make_file_record(cxx_path.parent_path().string(), cxx_path.filename().string(), sb));
+                }
+            }
+        } else if(errno == ENOENT || errno == ENOTDIR){
+            deleted.emplace_back(cxx_path.parent_path().string(), cxx_path.filename().string());
+        } else{
+            BOOST_LOG_TRIVIAL(error) << "stat call failed on " << path << ": " << strerror(errno);
+        }
+    }
+    writer.flush();
+
+    vector<int> ids;
+    vector<string> parents;
+    for (const auto &path : deleted) {
+        int file_id;
+        if(writer.find_file(path.first, path.second, file_id)){
+            ids.push_back(file_id);
+        }
+        parents.push_back(path.first);
+    }
+    writer.remove(ids);
+    if(!parents.empty() || !existing_subtrees.empty()){
+        remove_empty_parents(sql, roots, parents);
+        writer.forget_directories();
+    }
+
+    result.m_inserted += writer.inserted_count() - inserted;
+    result.m_updated += writer.updated_count() - updated;
+    result.m_removed += writer.removed_count() - removed;
+    result.m_failed += writer.failed_count() - failed;
+    return result;
+}
+
+// Indexes the roots once and then keeps the index current from inotify events until SIGINT or SIGTERM.
+// Events are collected until the paths stay quiet for the watch delay or the oldest change waits for the batch interval.
+void watch_files(const po::variables_map& vm, const string& database_path){
+    if(!check_report_options(vm)){
+        return;
+    }
+    const auto roots = resolve_roots(vm);
+    walk_filter filter;
+    if(!read_walk_filter(vm, roots, filter)){
+        return;
+    }
+    session &sql = get_sql_instance();
+    const bool incremental = vm["incremental"].as<bool>();
+
+    std::unique_ptr<inotify_watcher> watcher;
+    try{
+        watcher = std::make_unique<inotify_watcher>(roots, filter);
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(fatal) << "cannot watch files: " << err.what();
+        return;
+    }
+    // writing the database must not wake the watcher up, the journal files share the prefix
+    char rpath[PATH_MAX];
+    if(realpath(database_path.c_str(), rpath) != nullptr){
+        watcher->ignore_prefix(rpath);
+    }
+    // watches go first, changes made during the initial index are seen as events
+    watcher->watch_roots();
+    {
+        auto progress = start_progress(vm);
+        const auto result = index_roots({&sql}, shard_layout(), roots, filter, vm, incremental);
+        if(progress){
+            progress->stop();
+        }
+        print_index_result(cout, result, incremental);
+    }
+    cout << "Watched paths: " << watcher->watch_count() << endl;
+
+    struct sigaction action{};
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    const std::chrono::milliseconds delay(vm["watch-delay"].as<long>());
+    const std::chrono::milliseconds max_wait(vm["batch-ms"].as<long>());
+    index_writer writer(sql, vm["batch-size"].as<std::size_t>(), max_wait, begin_scan(sql));
+    watch_changes changes;
+    std::chrono::steady_clock::time_point first_change;
+    while(!stop_requested){
+        const bool was_empty = changes.empty();
+        const bool got_events = watcher->wait(was_empty ? watch_idle_interval : delay, changes);
+        if(changes.empty()){
+            continue;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if(was_empty){
+            first_change = now;
+        }
+        if(got_events && now - first_change < max_wait){
+            continue;
+        }
+        const auto result = apply_watch_changes(sql, writer, roots, filter, changes, vm);
+        changes.clear();
+        cout << "Applied changes: added " << result.m_inserted << ", updated " << result.m_updated
+             << ", removed " << result.m_removed;
+        if(result.m_failed != 0){
+            cout << ", failed " << result.m_failed;
+        }
+        cout << endl;
+    }
+    if(!changes.empty()){
+        apply_watch_changes(sql, writer, roots, filter, changes, vm);
+    }
+    dump_metrics(vm);
+    BOOST_LOG_TRIVIAL(info) << "watch stopped";
+}
+
+// Answers search and stat from memory until SIGINT or SIGTERM, see index_server for the protocol.
+void serve_index(const po::variables_map& vm, const string& database_path){
+    session &sql = get_sql_instance();
+    const string socket_path = vm.count("socket") ? vm["socket"].as<string>() : database_path + ".sock";
+    std::unique_ptr<index_server> server;
+    try{
+        server = std::make_unique<index_server>(sql, socket_path);
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(fatal) << "cannot serve the index: " << err.what();
+        return;
+    }
+    cout << "Serving " << server->index().view().m_files_count << " files on " << socket_path << endl;
+
+    struct sigaction action{};
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    // the database is checked for commits of other processes at most once per interval
+    const std::chrono::milliseconds reload_interval(std::max(1L, vm["reload-ms"].as<long>()));
+    auto next_check = std::chrono::steady_clock::now() + reload_interval;
+    while(!stop_requested){
+        const auto now = std::chrono::steady_clock::now();
+        if(now >= next_check){
+            try{
+                if(server->reload_if_changed()){
+                    cout << "Reloaded " << server->index().view().m_files_count << " files" << endl;
+                }
+            } catch (const std::exception& err){
+                BOOST_LOG_TRIVIAL(error) << "cannot reload the index: " << err.what();
+            }
+            next_check = std::chrono::steady_clock::now() + reload_interval;
+            continue;
+        }
+        server->wait(std::chrono::duration_cast<std::chrono::milliseconds>(next_check - now) +
+                     std::chrono::milliseconds(1));
+    }
+    cout << "Answered requests: " << server->requests_count() << endl;
+    BOOST_LOG_TRIVIAL(info) << "serve stopped";
+}
+
+// Optional size and modification time ranges, they apply to every search mode.
+struct search_filters{
+    boost::optional<long long> m_min_size;
+    boost::optional<long long> m_max_size;
+    boost::optional<long long> m_changed_after;
+    boost::optional<long long> m_changed_before;
+
+    bool empty() const{
+        return !m_min_size && !m_max_size && !m_changed_after && !m_changed_before;
+    }
+
+    // conditions to AND into the WHERE clause
+    vector<string> conditions() const{
+        vector<string> result;
+        if(m_min_size) result.emplace_back("f.file_size >= :min_size");
+        if(m_max_size) result.emplace_back("f.file_size <= :max_size");
+        if(m_changed_after) result.emplace_back("f.last_changed_at >= :changed_after");
+        if(m_changed_before) result.emplace_back("f.last_changed_at < :changed_before");
+        return result;
+    }
+
+    // values are bound by reference, the filters must outlive the statement
+    void bind(details::prepare_temp_type& prep) const{
+        if(m_min_size) prep, use(*m_min_size, "min_size");
+        if(m_max_size) prep, use(*m_max_size, "max_size");
+        if(m_changed_after) prep, use(*m_changed_after, "changed_after");
+        if(m_changed_before) prep, use(*m_changed_before, "changed_before");
+    }
+};
+
+bool read_search_filters(const po::variables_map& vm, search_filters& filters){
+    for (const auto &option : {"min", "max"}) {
+        if(!vm.count(option)){
+            continue;
+        }
+        long long bytes;
+        if(!parse_size(vm[option].as<string>(), bytes)){
+            cout << "Invalid size: " << vm[option].as<string>() << endl;
+            return false;
+        }
+        (string(option) == "min" ? filters.m_min_size : filters.m_max_size) = bytes;
+    }
+    for (const auto &option : {"changed-after", "changed-before"}) {
+        if(!vm.count(option)){
+            continue;
+        }
+        long long ns;
+        if(!parse_datetime(vm[option].as<string>(), ns)){
+            cout << "Invalid date: " << vm[option].as<string>() << endl;
+            return false;
+        }
+        (string(option) == "changed-after" ? filters.m_changed_after : filters.m_changed_before) = ns;
+    }
+    return true;
+}
+
+bool read_output_options(const po::variables_map& vm, output_options& options){
+    const auto &format = vm["format"].as<string>();
+    if(!parse_output_format(format, options.m_format)){
+        cout << "Invalid format: " << format << endl;
+        return false;
+    }
+    options.m_limit = vm["limit"].as<std::uint64_t>();
+    options.m_count_only = vm["count-only"].as<bool>();
+    return true;
+}
+
+// one row of a shard search waiting for the shared result writer
+struct found_file{
+    string m_directory;
+    string m_filename;
+    long long m_size = 0;
+    long long m_changed = 0;
+};
+
+void search_files(const po::variables_map& vm){
     const auto &search_by = vm["by"].as<string>();
+    search_filters filters;
+    if(!read_search_filters(vm, filters)){
+        return;
+    }
+    string target;
+    if(vm.count("target")){
+        target = vm["target"].as<string>();
+    } else if(search_by == "extension" || search_by == "directory" || search_by == "name"){
+        cout << "Search by " << search_by << " needs a target" << endl;
+        return;
+    }
+
+    output_options output;
+    if(!read_output_options(vm, output)){
+        return;
+    }
+
+    // tables and conditions of the mode, every mode selects the same columns from them
+    string query;
+    vector<string> where;
+    std::pair<string, string> bounds;
+    int max_slashes = 0;
+    bool bind_target = true, bind_subtree = false;
+    boost::optional<std::regex> name_regex;
     if(search_by == "extension"){
-        string ext = vm["target"].as<string>();
-        rowset<row> rs = (sql.prepare << "SELECT f.directory,f.filename FROM files f "
-                                         "INNER JOIN extensions e on e.id = f.extension_id WHERE e.extension = :ext ;",
-                                         use(ext, "ext"));
-        for (const auto &file : rs) {
-            cout << "Found file: " << file.get<string>(0) << "/" << file.get<string>(1);
-        }
+        query += "files f INNER JOIN extensions e on e.id = f.extension_id "
+                 "INNER JOIN directories d on d.id = f.directory_id ";
+        where.emplace_back("e.extension = :target");
     } else if(search_by == "directory"){
-        string dir = vm["target"].as<string>();
-        char *rpath = new char[PATH_MAX];
-        if(realpath(dir.c_str(), rpath) == nullptr){
-            BOOST_LOG_TRIVIAL(fatal) << "invalid dir: " << dir.c_str();
-            delete[] rpath;
+        char rpath[PATH_MAX];
+        if(realpath(target.c_str(), rpath) == nullptr){
+            BOOST_LOG_TRIVIAL(fatal) << "invalid dir: " << target.c_str();
             return;
         }
-        dir = rpath;
+        target = rpath;
 
-        rowset<row> rs = (sql.prepare << "SELECT f.directory,f.filename FROM files f WHERE f.directory = :dir", use(dir, "dir"));
-        for (const auto &file : rs) {
-            cout << "Found file: " << file.get<string>(0) << "/" << file.get<string>(1);
+        query += "directories d INNER JOIN files f on f.directory_id = d.id ";
+        if(!vm["recursive"].as<bool>()){
+            where.emplace_back("d.path = :target");
+        } else{
+            // subtree is a range scan over the path index, depth is checked per directory before its files are read
+            bounds = subtree_bounds(target);
+            const int depth = vm["depth"].as<int>();
+            max_slashes = depth < 0 ? std::numeric_limits<int>::max() : path_depth(target) + depth;
+            where.emplace_back("(d.path = :target OR (d.path >= :lower AND d.path < :upper "
+                               "AND length(d.path) - length(replace(d.path, '/', '')) <= :max_slashes))");
+            bind_subtree = true;
         }
-    }
-    else{
+    } else if(search_by == "name" && vm["regex"].as<bool>()){
+        // no index can serve a regex, every name is checked
+        try{
+            name_regex = std::regex(target);
+        } catch (const std::regex_error& err){
+            cout << "Invalid regex: " << target << ": " << err.what() << endl;
+            return;
+        }
+        query += "files f INNER JOIN directories d on d.id = f.directory_id ";
+        bind_target = false;
+    } else if(search_by == "name"){
+        // GLOB on the trigram table is answered from the index, a plain target is a substring
+        if(target.find_first_of("*?[") == string::npos){
+            target = "*" + target + "*";
+        }
+        query += "files_names n INNER JOIN files f on f.id = n.rowid "
+                 "INNER JOIN directories d on d.id = f.directory_id ";
+        where.emplace_back("n.filename GLOB :target");
+    } else if(search_by == "size" || search_by == "changed"){
+        if(filters.empty()){
+            cout << "Search by " << search_by << " needs --min/--max or --changed-after/--changed-before" << endl;
+            return;
+        }
+        query += "files f INNER JOIN directories d on d.id = f.directory_id ";
+        bind_target = false;
+    } else{
         BOOST_LOG_TRIVIAL(info) << "got invalid argument";
         cout << "Invalid argument: " << search_by << endl;
         return;
     }
+
+    for (auto &condition : filters.conditions()) {
+        where.push_back(std::move(condition));
+    }
+    for (std::size_t i = 0; i < where.size(); ++i) {
+        query += (i == 0 ? "WHERE " : " AND ") + where[i];
+    }
+    // the limit and the count are left to sqlite, unless a regex drops rows here
+    const bool count_in_sql = output.m_count_only && !name_regex;
+    long long limit = static_cast<long long>(output.m_limit);
+    const bool limit_in_sql = limit != 0 && !name_regex;
+    if(count_in_sql){
+        query = limit_in_sql ? "SELECT COUNT(*) FROM (SELECT 1 FROM " + query + " LIMIT :limit)"
+                             : "SELECT COUNT(*) FROM " + query;
+    } else{
+        query = string("SELECT d.path, f.filename") + (output.with_details() ? ", f.file_size, f.last_changed_at" : "") +
+                " FROM " + query + (limit_in_sql ? " LIMIT :limit" : "");
+    }
+
+    // Runs the query on one shard and hands every row to `found` until it returns false.
+    // Values are bound by reference and must outlive the statement, fetched rows reuse the same strings.
+    auto search_shard = [&](session& sql, const std::function<bool(const string&, const string&, long long, long long)>& found){
+        details::prepare_temp_type prep = (sql.prepare << query);
+        if(bind_target){
+            prep, use(target, "target");
+        }
+        if(bind_subtree){
+            prep, use(bounds.first, "lower"), use(bounds.second, "upper"), use(max_slashes, "max_slashes");
+        }
+        filters.bind(prep);
+        if(limit_in_sql){
+            prep, use(limit, "limit");
+        }
+        string directory, filename;
+        long long size = 0, changed = 0;
+        // the only row of a count query has the count in size
+        if(count_in_sql){
+            prep, into(size);
+        } else{
+            prep, into(directory), into(filename);
+            if(output.with_details()){
+                prep, into(size), into(changed);
+            }
+        }
+        statement st(prep);
+        st.execute();
+        while(st.fetch()){
+            if(name_regex && !std::regex_search(filename, *name_regex)){
+                continue;
+            }
+            if(!found(directory, filename, size, changed)){
+                break;
+            }
+        }
+    };
+
+    result_writer writer(cout, output);
+    const auto shards = get_shards();
+    if(shards.size() == 1){
+        search_shard(*shards.front(), [&](const string& directory, const string& filename, long long size, long long changed){
+            if(count_in_sql){
+                writer.add_counted(static_cast<std::uint64_t>(size));
+                return true;
+            }
+            return writer.add(directory, filename, size, changed);
+        });
+        return;
+    }
+    // Shards are searched concurrently, each hands its rows to the shared writer in chunks,
+    // so they rarely wait for each other. The limit is checked for all of them together.
+    std::mutex writer_mutex;
+    run_on_shards(static_cast<unsigned>(shards.size()), [&](unsigned shard){
+        vector<found_file> chunk(search_chunk_files);
+        std::size_t used = 0;
+        auto write_chunk = [&]{
+            std::lock_guard<std::mutex> lock(writer_mutex);
+            for (std::size_t i = 0; i < used && !writer.full(); ++i) {
+                writer.add(chunk[i].m_directory, chunk[i].m_filename, chunk[i].m_size, chunk[i].m_changed);
+            }
+            used = 0;
+            return !writer.full();
+        };
+        search_shard(*shards[shard], [&](const string& directory, const string& filename, long long size, long long changed){
+            if(count_in_sql){
+                std::lock_guard<std::mutex> lock(writer_mutex);
+                writer.add_counted(static_cast<std::uint64_t>(size));
+                return true;
+            }
+            auto &file = chunk[used++];
+            file.m_directory = directory;
+            file.m_filename = filename;
+            file.m_size = size;
+            file.m_changed = changed;
+            return used < chunk.size() || write_chunk();
+        });
+        write_chunk();
+    });
 }
 
-void print_stat(std::ostream& out, const po::variables_map& vm){
+// one indexed file that has the same size as another one
+struct dupe_candidate{
+    int m_id = 0;
+    string m_path;
+    long long m_size = 0;
+    long long m_last_changed = 0;
+    long long m_content_hash = 0;
+    bool m_hashed = false;
+};
+
+// hashes the files of `groups` with `limit` bytes each, files whose size or mtime differ from the index are dropped
+void hash_candidates(vector<vector<dupe_candidate*>>& groups, std::uint64_t limit, unsigned threads,
+                     vector<long long>& hashes){
+    vector<hash_job> jobs;
+    for (const auto &group : groups) {
+        for (const auto *candidate : group) {
+            hash_job job;
+            job.m_path = candidate->m_path;
+            job.m_limit = limit;
+            jobs.push_back(std::move(job));
+        }
+    }
+    hash_files(jobs, threads);
+    hashes.clear();
+    std::size_t i = 0;
+    for (auto &group : groups) {
+        vector<dupe_candidate*> hashed;
+        for (auto *candidate : group) {
+            const auto &job = jobs[i++];
+            if(!job.m_ok || job.m_stat.st_size != candidate->m_size ||
+               timespec_to_ns(job.m_stat.st_mtim) != candidate->m_last_changed){
+                BOOST_LOG_TRIVIAL(warning) << "skipping " << candidate->m_path << ", it changed since it was indexed";
+                continue;
+            }
+            hashed.push_back(candidate);
+            hashes.push_back(static_cast<long long>(job.m_hash));
+        }
+        group = std::move(hashed);
+    }
+}
+
+// splits every group by `key`, groups of one file are dropped
+template<class Key>
+vector<vector<dupe_candidate*>> split_groups(const vector<vector<dupe_candidate*>>& groups, Key key){
+    vector<vector<dupe_candidate*>> result;
+    for (const auto &group : groups) {
+        std::map<long long, vector<dupe_candidate*>> by_key;
+        for (auto *candidate : group) {
+            by_key[key(candidate)].push_back(candidate);
+        }
+        for (auto &item : by_key) {
+            if(item.second.size() > 1){
+                result.push_back(std::move(item.second));
+            }
+        }
+    }
+    return result;
+}
+
+// Finds files with the same content.
+// Only files sharing their size with another file are candidates, they come sorted from the size index.
+// Files without a stored hash are hashed on --jobs threads: first the head of every file in a group,
+// then in full only the files whose head matched another one. Full hashes are stored for the next run.
+void print_duplicates(std::ostream& out, const po::variables_map& vm){
     session &sql = get_sql_instance();
-    int files_count;
-    sql << "SELECT COUNT(*) FROM `files`;", into(files_count);
-    out << "Total files count: " << files_count << endl;
-
-    int total_ext_count;
-    sql << "SELECT COUNT(*) FROM `extensions`;", into(total_ext_count);
-    out << "Total extensions count: " << total_ext_count << endl;
-
-    rowset<row> rs = (sql.prepare << "SELECT e.extension, COUNT(f.extension_id) AS files_count "
-                                     "FROM extensions e "
-                                     "LEFT JOIN files f ON e.id = f.extension_id GROUP BY e.id "
-                                     "ORDER BY files_count DESC "
-                                     "LIMIT :limit ;",
-                                     use(stat_ext_sql_limit, "limit"));
-    for (const auto &extension : rs) {
-        auto ext = extension.get<string>(0);
-        int ext_count = std::stoi(extension.get<string>(1));
+    search_filters filters;
+    if(!read_search_filters(vm, filters)){
+        return;
+    }
+    // every empty file is a copy of every other one
+    if(!filters.m_min_size){
+        filters.m_min_size = 1;
+    }
+    string query = "SELECT f.id, d.path, f.filename, f.file_size, f.last_changed_at, f.content_hash "
+                   "FROM files f INNER JOIN directories d on d.id = f.directory_id";
+    const auto conditions = filters.conditions();
+    for (std::size_t i = 0; i < conditions.size(); ++i) {
+        query += (i == 0 ? " WHERE " : " AND ") + conditions[i];
+    }
+    query += " ORDER BY f.file_size;";
+
+    std::deque<dupe_candidate> candidates;
+    vector<vector<dupe_candidate*>> groups;
+    {
+        int id;
+        string directory, filename;
+        long long size, last_changed, content_hash;
+        indicator hash_indicator;
+        details::prepare_temp_type prep = (sql.prepare << query);
+        prep, into(id), into(directory), into(filename), into(size), into(last_changed),
+                into(content_hash, hash_indicator);
+        filters.bind(prep);
+        statement st(prep);
+        st.execute();
+        vector<dupe_candidate> run;
+        auto close_run = [&]{
+            if(run.size() > 1){
+                groups.emplace_back();
+                for (auto &candidate : run) {
+                    candidates.push_back(std::move(candidate));
+                    groups.back().push_back(&candidates.back());
+                }
+            }
+            run.clear();
+        };
+        while(st.fetch()){
+            if(!run.empty() && run.back().m_size != size){
+                close_run();
+            }
+            dupe_candidate candidate;
+            candidate.m_id = id;
+            candidate.m_path = join_path(directory, filename);
+            candidate.m_size = size;
+            candidate.m_last_changed = last_changed;
+            candidate.m_hashed = hash_indicator == i_ok;
+            candidate.m_content_hash = candidate.m_hashed ? content_hash : 0;
+            run.push_back(std::move(candidate));
+        }
+        close_run();
+    }
+    BOOST_LOG_TRIVIAL(info) << "found " << candidates.size() << " files in " << groups.size() << " same size groups";
+
+    const unsigned threads = vm["jobs"].as<unsigned>();
+    vector<long long> hashes;
+    // groups that are fully hashed already skip both passes
+    vector<vector<dupe_candidate*>> hashed_groups, unhashed_groups;
+    for (auto &group : groups) {
+        const bool all_hashed = std::all_of(group.begin(), group.end(),
+                                            [](const dupe_candidate* c){ return c->m_hashed; });
+        (all_hashed ? hashed_groups : unhashed_groups).push_back(std::move(group));
+    }
+
+    // head pass, for files not larger than the head it is the full hash already
+    vector<vector<dupe_candidate*>> large_groups;
+    {
+        hash_candidates(unhashed_groups, head_hash_bytes, threads, hashes);
+        std::unordered_map<const dupe_candidate*, long long> heads;
+        std::size_t i = 0;
+        for (const auto &group : unhashed_groups) {
+            for (auto *candidate : group) {
+                heads[candidate] = hashes[i++];
+            }
+        }
+        auto by_head = split_groups(unhashed_groups, [&heads](const dupe_candidate* c){ return heads[c]; });
+        for (auto &group : by_head) {
+            if(static_cast<std::uint64_t>(group.front()->m_size) <= head_hash_bytes){
+                for (auto *candidate : group) {
+                    candidate->m_content_hash = heads[candidate];
+                    candidate->m_hashed = true;
+                }
+                hashed_groups.push_back(std::move(group));
+            } else{
+                large_groups.push_back(std::move(group));
+            }
+        }
+    }
+    // full pass over the files without a stored hash
+    {
+        vector<vector<dupe_candidate*>> missing;
+        for (const auto &group : large_groups) {
+            missing.emplace_back();
+            std::copy_if(group.begin(), group.end(), std::back_inserter(missing.back()),
+                         [](const dupe_candidate* c){ return !c->m_hashed; });
+        }
+        hash_candidates(missing, UINT64_MAX, threads, hashes);
+        std::size_t i = 0;
+        for (const auto &group : missing) {
+            for (auto *candidate : group) {
+                candidate->m_content_hash = hashes[i++];
+                candidate->m_hashed = true;
+            }
+        }
+        for (auto &group : large_groups) {
+            // files that changed since they were indexed are still unhashed
+            group.erase(std::remove_if(group.begin(), group.end(), [](const dupe_candidate* c){ return !c->m_hashed; }),
+                        group.end());
+            hashed_groups.push_back(std::move(group));
+        }
+    }
+
+    // computed hashes are stored unless the file changed in the meantime
+    try{
+        int id;
+        long long size, last_changed, content_hash;
+        BOOST_LOG_TRIVIAL(debug) << "beginning transaction";
+        sql << "BEGIN TRANSACTION;";
+        statement st = (sql.prepare << "UPDATE `files` SET content_hash = :hash "
+                                       "WHERE id = :id AND file_size = :size AND last_changed_at = :changed "
+                                       "AND content_hash IS NULL;",
+                use(content_hash, "hash"), use(id, "id"), use(size, "size"), use(last_changed, "changed"));
+        for (const auto &group : hashed_groups) {
+            for (const auto *candidate : group) {
+                id = candidate->m_id;
+                size = candidate->m_size;
+                last_changed = candidate->m_last_changed;
+                content_hash = candidate->m_content_hash;
+                st.execute(true);
+            }
+        }
+        BOOST_LOG_TRIVIAL(debug) << "committing transaction";
+        sql << "COMMIT";
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(info) << "rolling back";
+        sql << "ROLLBACK;";
+        BOOST_LOG_TRIVIAL(error) << "error while storing content hashes: " << err.what();
+    }
+
+    auto duplicates = split_groups(hashed_groups, [](const dupe_candidate* c){ return c->m_content_hash; });
+    // the most wasted space first
+    std::sort(duplicates.begin(), duplicates.end(), [](const auto& a, const auto& b){
+        return a.front()->m_size * static_cast<long long>(a.size() - 1) >
+               b.front()->m_size * static_cast<long long>(b.size() - 1);
+    });
+    std::size_t copies = 0;
+    long long wasted = 0;
+    for (auto &group : duplicates) {
+        std::sort(group.begin(), group.end(), [](const dupe_candidate* a, const dupe_candidate* b){
+            return a->m_path < b->m_path;
+        });
+        out << "Same content, " << group.size() << " files of " << group.front()->m_size << " bytes:" << '\n';
+        for (const auto *candidate : group) {
+            out << "Found file: " << candidate->m_path << '\n';
+        }
+        out << '\n';
+        copies += group.size() - 1;
+        wasted += group.front()->m_size * static_cast<long long>(group.size() - 1);
+    }
+    out << "Duplicate groups: " << duplicates.size() << endl;
+    out << "Redundant copies: " << copies << endl;
+    out << "Redundant bytes: " << wasted << endl;
+}
+
+// what one shard holds for stat by extension
+struct extension_stat{
+    long long m_files_count = 0;
+    long long m_total_size = 0;
+    // files per extension, extensions without files are kept with 0 so they are counted
+    std::unordered_map<string, long long> m_extension_files;
+    long long m_max_size = -1;
+    string m_biggest_file;
+};
+
+// Reads the aggregates kept by the triggers, no query here scans `files`.
+void read_extension_stat(session& sql, extension_stat& stat){
+    sql << "SELECT coalesce(SUM(files_count), 0), coalesce(SUM(total_size), 0) FROM `extension_stats`;",
+            into(stat.m_files_count), into(stat.m_total_size);
+
+    string ext;
+    long long ext_count;
+    statement st = (sql.prepare << "SELECT e.extension, coalesce(s.files_count, 0) FROM `extensions` e "
+                                   "LEFT JOIN `extension_stats` s ON s.extension_id = e.id;",
+            into(ext), into(ext_count));
+    st.execute();
+    while(st.fetch()){
+        stat.m_extension_files.emplace(ext, ext_count);
+    }
+    if(stat.m_files_count == 0){
+        return;
+    }
+    // the last entry of the size index
+    string directory, filename;
+    sql << "SELECT f.file_size, d.path, f.filename FROM files f "
+           "INNER JOIN directories d on d.id = f.directory_id ORDER BY f.file_size DESC LIMIT 1;",
+            into(stat.m_max_size), into(directory), into(filename);
+    stat.m_biggest_file = join_path(directory, filename);
+}
+
+// shards are read concurrently and summed, the top extensions are picked from the sums
+void print_extension_stat(std::ostream& out){
+    const auto shards = get_shards();
+    vector<extension_stat> shard_stats(shards.size());
+    run_on_shards(static_cast<unsigned>(shards.size()), [&](unsigned shard){
+        read_extension_stat(*shards[shard], shard_stats[shard]);
+    });
+    extension_stat total;
+    for (auto &stat : shard_stats) {
+        total.m_files_count += stat.m_files_count;
+        total.m_total_size += stat.m_total_size;
+        for (const auto &item : stat.m_extension_files) {
+            total.m_extension_files[item.first] += item.second;
+        }
+        if(stat.m_max_size > total.m_max_size){
+            total.m_max_size = stat.m_max_size;
+            total.m_biggest_file = std::move(stat.m_biggest_file);
+        }
+    }
+    out << "Total files count: " << total.m_files_count << endl;
+    out << "Total extensions count: " << total.m_extension_files.size() << endl;
+
+    vector<std::pair<string, long long>> extensions;
+    for (const auto &item : total.m_extension_files) {
+        if(item.second != 0){
+            extensions.emplace_back(item.first, item.second);
+        }
+    }
+    const auto limit = std::min<std::size_t>(stat_ext_sql_limit, extensions.size());
+    std::partial_sort(extensions.begin(), extensions.begin() + limit, extensions.end(),
+                      [](const auto& a, const auto& b){ return a.second > b.second; });
+    for (std::size_t i = 0; i < limit; ++i) {
+        const auto &ext = extensions[i].first;
         if(ext.empty()) {
-            out << "Total files without extensions: " << ext_count << endl;
+            out << "Total files without extensions: " << extensions[i].second << endl;
         }
         else{
-            out << "Total files with extension " << std::quoted(ext) << " are " << ext_count << endl;
+            out << "Total files with extension " << std::quoted(ext) << " are " << extensions[i].second << endl;
+        }
+    }
+    if(total.m_files_count == 0){
+        return;
+    }
+    out << "Biggest file with size " << total.m_max_size << "B is " << total.m_biggest_file << endl;
+
+    out << "Mean file size is " << std::fixed << std::setprecision(2)
+        << static_cast<double>(total.m_total_size) / static_cast<double>(total.m_files_count) << "B" << endl;
+}
+
+// cumulative size of one directory and everything below it
+struct subtree_stat{
+    string m_path;
+    long long m_files_count = 0;
+    long long m_total_size = 0;
+};
+
+// Cumulative sizes of the subtrees of `target` in one shard down to `max_depth`.
+// Directories come in descending path order, so every child is summed before its parent
+// and the whole roll up is one pass over `directories`.
+vector<subtree_stat> read_subtree_stats(session& sql, const string& target, int max_depth){
+    const auto bounds = subtree_bounds(target);
+    int id, parent_id;
+    indicator parent_indicator;
+    string path;
+    long long files_count, total_size;
+    statement st = (sql.prepare << "SELECT d.id, d.parent_id, d.path, coalesce(s.files_count, 0), coalesce(s.total_size, 0) "
+                                   "FROM `directories` d LEFT JOIN `directory_stats` s ON s.directory_id = d.id "
+                                   "WHERE d.path = :dir OR (d.path >= :lower AND d.path < :upper) "
+                                   "ORDER BY d.path DESC;",
+            into(id), into(parent_id, parent_indicator), into(path), into(files_count), into(total_size),
+            use(target, "dir"), use(bounds.first, "lower"), use(bounds.second, "upper"));
+    st.execute();
+    // totals of children waiting for their parent
+    std::unordered_map<int, std::pair<long long, long long>> pending;
+    vector<subtree_stat> subtrees;
+    while(st.fetch()){
+        subtree_stat stat;
+        stat.m_files_count = files_count;
+        stat.m_total_size = total_size;
+        auto it = pending.find(id);
+        if(it != pending.end()){
+            stat.m_files_count += it->second.first;
+            stat.m_total_size += it->second.second;
+            pending.erase(it);
+        }
+        if(parent_indicator == i_ok && path != target){
+            auto &parent = pending[parent_id];
+            parent.first += stat.m_files_count;
+            parent.second += stat.m_total_size;
+        }
+        if(path_depth(path) <= max_depth){
+            stat.m_path = path;
+            subtrees.push_back(std::move(stat));
+        }
+    }
+    return subtrees;
+}
+
+// Largest subtrees by cumulative size, like du.
+// Shards are rolled up concurrently, a directory split between shards is summed by its path.
+void print_directory_stat(std::ostream& out, const po::variables_map& vm){
+    string target = "/";
+    if(vm.count("target")){
+        char rpath[PATH_MAX];
+        if(realpath(vm["target"].as<string>().c_str(), rpath) == nullptr){
+            cout << "Invalid directory: " << vm["target"].as<string>() << endl;
+            return;
+        }
+        target = rpath;
+    }
+    const int depth = vm["depth"].as<int>();
+    const int max_depth = depth < 0 ? std::numeric_limits<int>::max() : path_depth(target) + depth;
+
+    const auto shards = get_shards();
+    vector<vector<subtree_stat>> shard_subtrees(shards.size());
+    run_on_shards(static_cast<unsigned>(shards.size()), [&](unsigned shard){
+        shard_subtrees[shard] = read_subtree_stats(*shards[shard], target, max_depth);
+    });
+    vector<subtree_stat> subtrees = std::move(shard_subtrees.front());
+    if(shards.size() > 1){
+        std::unordered_map<string, std::size_t> positions;
+        for (std::size_t i = 0; i < subtrees.size(); ++i) {
+            positions.emplace(subtrees[i].m_path, i);
+        }
+        for (std::size_t shard = 1; shard < shard_subtrees.size(); ++shard) {
+            for (auto &stat : shard_subtrees[shard]) {
+                const auto inserted = positions.emplace(stat.m_path, subtrees.size());
+                if(inserted.second){
+                    subtrees.push_back(std::move(stat));
+                } else{
+                    subtrees[inserted.first->second].m_files_count += stat.m_files_count;
+                    subtrees[inserted.first->second].m_total_size += stat.m_total_size;
+                }
+            }
         }
     }
-    row biggest_file;
-    sql << "SELECT MAX(file_size) AS max_size,directory,filename FROM files;", into(biggest_file);
+    const auto limit = std::min<std::size_t>(stat_directory_limit, subtrees.size());
+    std::partial_sort(subtrees.begin(), subtrees.begin() + limit, subtrees.end(),
+                      [](const subtree_stat& a, const subtree_stat& b){ return a.m_total_size > b.m_total_size; });
+    for (std::size_t i = 0; i < limit; ++i) {
+        out << "Subtree " << subtrees[i].m_path << " has " << subtrees[i].m_files_count
+            << " files with total size " << subtrees[i].m_total_size << "B" << endl;
+    }
+}
+
+void print_stat(std::ostream& out, const po::variables_map& vm){
+    const auto &stat_by = vm["by"].as<string>();
+    if(stat_by == "extension"){
+        print_extension_stat(out);
+    } else if(stat_by == "directory"){
+        print_directory_stat(out, vm);
+    } else{
+        cout << "Invalid argument: " << stat_by << endl;
+    }
+}
+
+// the search or stat query for an index_view, invalid options are reported like search_files does
+bool read_view_query(const po::variables_map& vm, view_query& query){
+    search_filters filters;
+    if(!read_search_filters(vm, filters)){
+        return false;
+    }
+    query.m_by = vm["by"].as<string>();
+    if(vm.count("target")){
+        query.m_target = vm["target"].as<string>();
+    }
+    query.m_min_size = filters.m_min_size;
+    query.m_max_size = filters.m_max_size;
+    query.m_changed_after = filters.m_changed_after;
+    query.m_changed_before = filters.m_changed_before;
+    query.m_regex = vm["regex"].as<bool>();
+    query.m_recursive = vm["recursive"].as<bool>();
+    query.m_depth = vm["depth"].as<int>();
+    return true;
+}
 
-    out << "Biggest file with size " << biggest_file.get<string>(0) << "B is " << biggest_file.get<string>(1) << "/" << biggest_file.get<string>(2) << endl;
+// search and stat on a snapshot written by export, the database is not opened at all
+bool query_snapshot(const po::variables_map& vm, const string& cmd){
+    view_query query;
+    output_options output;
+    if(!read_view_query(vm, query) || !read_output_options(vm, output)){
+        return false;
+    }
+    std::unique_ptr<snapshot_file> snapshot;
+    try{
+        snapshot = std::make_unique<snapshot_file>(vm["snapshot"].as<string>(), vm["verify"].as<bool>());
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(fatal) << "cannot open snapshot: " << err.what();
+        return false;
+    }
+    string error;
+    bool ok;
+    if(cmd == "search"){
+        result_writer writer(cout, output);
+        ok = search_view(snapshot->view(), query, writer, error);
+    } else{
+        ok = stat_view(snapshot->view(), query, cout, error);
+    }
+    if(!ok){
+        cout << error << endl;
+    }
+    return ok;
+}
 
-    string avg_file_size;
-    sql << "SELECT PRINTF(\"%.2f\", AVG(file_size)) AS mean_size FROM files;", into(avg_file_size);
-    out << "Mean file size is " << avg_file_size << "B" << endl;
+void export_snapshot(const po::variables_map& vm){
+    if(!vm.count("snapshot")){
+        cout << "Export needs --snapshot" << endl;
+        return;
+    }
+    const auto &path = vm["snapshot"].as<string>();
+    memory_index index;
+    try{
+        index.load(get_sql_instance());
+        write_snapshot(index.view(), path);
+    } catch (const std::exception& err){
+        BOOST_LOG_TRIVIAL(fatal) << "cannot export snapshot: " << err.what();
+        return;
+    }
+    cout << "Exported files: " << index.view().m_files_count << endl;
+    cout << "Snapshot size: " << fs::file_size(path) << "B" << endl;
 }
 
 
 
+// opens the database file, creating its schema if it is new, and brings the schema up to date
+bool open_database(session& sql, const string& database_url, const database_profile& profile, int busy_timeout_ms){
+    bool database_exists = path_exists(database_url);
+    try {
+        BOOST_LOG_TRIVIAL(info) << "opening connection to database on url: " << database_url;
+        sql.open(sqlite3, database_url);
+        configure_database(sql, profile, busy_timeout_ms, !database_exists);
+    } catch (const std::exception &err) {
+        BOOST_LOG_TRIVIAL(fatal) << "error while connecting to database: " << err.what() << endl;
+        return false;
+    }
+
+    if (!database_exists) {
+        BOOST_LOG_TRIVIAL(info) << "creating database schema";
+        try {
+            create_database(sql);
+        } catch (const std::exception &err) {
+            BOOST_LOG_TRIVIAL(info) << "rolling back";
+            sql << "ROLLBACK;";
+            BOOST_LOG_TRIVIAL(fatal) << "Error while creating database(tables): " << err.what();
+            return false;
+        }
+    }
+
+    try {
+        migrate_database(sql);
+    } catch (const std::exception &err) {
+        BOOST_LOG_TRIVIAL(info) << "rolling back";
+        sql << "ROLLBACK;";
+        BOOST_LOG_TRIVIAL(fatal) << "Error while migrating database schema: " << err.what();
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char **argv) {
     init_logging();
 
@@ -475,17 +1575,99 @@ int main(int argc, char **argv) {
             ("index-database-file,d", po::value<string>()->default_value("index.sqlite"),
              "output database file to save indexes")
             ("command", po::value<command>()->default_value(command("index")),
-             "command to execute(available: index, search, stat)");
+             "command to execute(available: index, search, stat, watch, dupes, serve, export)")
+            ("db-profile", po::value<string>()->default_value("safe"),
+             "database durability and cache settings(allowed: safe, fast; fast may lose the last batches on power loss)")
+            ("busy-timeout", po::value<int>()->default_value(5000),
+             "milliseconds to wait for a database locked by another process")
+            ("snapshot", po::value<string>(),
+             "snapshot file that export writes, search and stat read it instead of the database")
+            ("verify", po::bool_switch()->default_value(false),
+             "check every string and index of the snapshot before search and stat use it, reads the whole file")
+            ("shards", po::value<unsigned>()->default_value(1),
+             "number of database files the index is split into, shard N of index.sqlite is index.N.sqlite; "
+             "index writes and search and stat read them in parallel")
+            ("shard-by", po::value<string>()->default_value("root"),
+             "how index splits files between shards(allowed: root, hash; root keeps every index path in one shard, "
+             "hash spreads directories by a hash of their path)");
 
     po::positional_options_description p;
     p.add("command", 1);
     p.add("index-path", -1);
 
+    po::options_description index_desc("Index options");
+    index_desc.add_options()
+            ("jobs,j", po::value<unsigned>()->default_value(std::max(1u, std::thread::hardware_concurrency())),
+             "number of threads walking directories")
+            ("incremental", po::bool_switch()->default_value(false),
+             "load the current index once and write only new, changed and removed files")
+            ("batch-size", po::value<std::size_t>()->default_value(5000),
+             "max number of files written to the database in one transaction")
+            ("batch-ms", po::value<long>()->default_value(1000),
+             "max time in milliseconds a file waits in a batch before it is written")
+            ("hash", po::bool_switch()->default_value(false),
+             "store a hash of the file contents, files with unchanged size and mtime keep their hash")
+            ("io-uring", po::bool_switch()->default_value(false),
+             "stat the files of a directory through io_uring with many calls in flight, helps on NFS and FUSE; "
+             "stat calls are used when io_uring is not available")
+            ("exclude", po::value<vector<string>>()->default_value(vector<string>(), "{empty list}")->composing(),
+             "skip files and directories matching this glob, e.g. .git, node_modules, *.o or build/ for directories "
+             "only; a pattern with a slash matches the path below the index path")
+            ("include", po::value<vector<string>>()->default_value(vector<string>(), "{empty list}")->composing(),
+             "index only files matching one of these globs, directories are still walked unless excluded")
+            ("ignore-file", po::value<string>(),
+             "file with an exclude glob per line, # starts a comment, ! starts an include glob")
+            ("extension", po::value<vector<string>>()->default_value(vector<string>(), "{empty list}")->composing(),
+             "index only files with these extensions, comma separated or repeated, e.g. cpp,h")
+            ("max-depth", po::value<int>()->default_value(-1),
+             "max depth of walked directories below an index path(0 is the files of the path itself, -1 is unlimited)")
+            ("one-file-system", po::bool_switch()->default_value(false),
+             "do not walk into directories on another filesystem than the index path, like /proc or network mounts")
+            ("progress", po::value<string>()->default_value("auto"),
+             "progress line on stderr(allowed: auto, always, never; auto prints it when stderr is a terminal)")
+            ("progress-ms", po::value<long>()->default_value(1000), "milliseconds between progress lines")
+            ("metrics-file", po::value<string>(), "write counters and timers of the run to this file at the end")
+            ("metrics-format", po::value<string>()->default_value("prometheus"),
+             "format of the metrics file(allowed: prometheus, json)");
+    desc.add(index_desc);
+
+    po::options_description watch_desc("Watch options");
+    watch_desc.add_options()
+            ("watch-delay", po::value<long>()->default_value(200),
+             "milliseconds without new events before collected changes are written, "
+             "changes never wait longer than --batch-ms");
+    desc.add(watch_desc);
+
+    po::options_description serve_desc("Serve options");
+    serve_desc.add_options()
+            ("socket", po::value<string>(), "unix socket to listen on(default: database file with .sock appended)")
+            ("reload-ms", po::value<long>()->default_value(1000),
+             "milliseconds between checks whether the database changed and the index has to be loaded again");
+    desc.add(serve_desc);
+
     po::options_description search_desc("Search options");
     search_desc.add_options()
             ("by,b", po::value<string>()->default_value("extension"), "searching by some measure"
-                                                                      "(allowed: extension, directory)")
-            ("target", po::value<string>()->required(), "search statement");
+                                                                      "(allowed: extension, directory, name, size, changed; "
+                                                                      "stat allows extension, directory)")
+            ("target", po::value<string>(), "search statement(stat by directory: directory to report on)")
+            ("min", po::value<string>(), "min file size, K, M, G, T suffixes are powers of 1024")
+            ("max", po::value<string>(), "max file size, K, M, G, T suffixes are powers of 1024")
+            ("changed-after", po::value<string>(),
+             "files changed at or after this time: YYYY-MM-DD[ HH:MM[:SS]] in UTC or @unix_seconds")
+            ("changed-before", po::value<string>(),
+             "files changed before this time: YYYY-MM-DD[ HH:MM[:SS]] in UTC or @unix_seconds")
+            ("regex", po::bool_switch()->default_value(false),
+             "search by name treats target as a regular expression instead of a substring or glob")
+            ("recursive,r", po::bool_switch()->default_value(false),
+             "search by directory includes all subdirectories")
+            ("depth", po::value<int>()->default_value(-1),
+             "max depth of subdirectories for recursive search and stat by directory(0 is the directory itself, -1 is unlimited)")
+            ("format", po::value<string>()->default_value("text"),
+             "search output(allowed: text, plain, null, json, csv; plain is one path per line, null ends paths with NUL "
+             "for xargs -0, json is one object per line)")
+            ("limit", po::value<std::uint64_t>()->default_value(0), "print at most this many files(0 is no limit)")
+            ("count-only", po::bool_switch()->default_value(false), "print only the number of found files");
 
 
     po::variables_map vm;
@@ -512,50 +1694,91 @@ int main(int argc, char **argv) {
         return EXIT_SUCCESS;
     }
 
+    // search, stat and dupes take the search options too
+    auto parse_search_options = [&]() -> bool {
+        try{
+            desc.add(search_desc);
+            po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+            po::notify(vm);
+        } catch(...){
+            cout << "Invalid argument was passed" << endl;
+            printUsage(argv[0], p, desc);
+            return false;
+        }
+        return true;
+    };
 
-    session &sql = get_sql_instance();
-    const auto &database_url = vm["index-database-file"].as<string>();
+    string cmd = vm["command"].as<command>().m_name;
+    if ((cmd == "search" || cmd == "stat") && vm.count("snapshot")) {
+        if(!parse_search_options()){
+            return EXIT_FAILURE;
+        }
+        return query_snapshot(vm, cmd) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    bool database_exists = path_exists(database_url);
 
-    try {
-        BOOST_LOG_TRIVIAL(info) << "opening connection to database on url: " << database_url;
-        sql.open(sqlite3, database_url);
-    } catch (const std::exception &err) {
-        BOOST_LOG_TRIVIAL(fatal) << "error while connecting to database: " << err.what() << endl;
+    const auto &database_url = vm["index-database-file"].as<string>();
+    const database_profile *profile = find_database_profile(vm["db-profile"].as<string>());
+    if (!profile) {
+        cout << "Invalid argument: " << vm["db-profile"].as<string>() << endl;
+        return EXIT_FAILURE;
+    }
+    shard_layout layout;
+    layout.m_count = vm["shards"].as<unsigned>();
+    if (layout.m_count == 0 || layout.m_count > max_shards) {
+        cout << "Invalid argument: " << layout.m_count << endl;
+        return EXIT_FAILURE;
+    }
+    if (!parse_shard_by(vm["shard-by"].as<string>(), layout.m_by)) {
+        cout << "Invalid argument: " << vm["shard-by"].as<string>() << endl;
+        return EXIT_FAILURE;
+    }
+    if (vm["shards"].defaulted() && !path_exists(database_url) && path_exists(shard_database_path(database_url, 0, 2))) {
+        cout << database_url << " is split into shards, pass --shards" << endl;
+        return EXIT_FAILURE;
+    }
+    if (layout.m_count > 1 && cmd != "index" && cmd != "search" && cmd != "stat") {
+        cout << "Command " << cmd << " does not work on a sharded index" << endl;
         return EXIT_FAILURE;
     }
 
-    if (!database_exists) {
-        BOOST_LOG_TRIVIAL(info) << "creating database schema";
+    for (unsigned shard = 0; shard < layout.m_count; ++shard) {
+        const auto path = shard_database_path(database_url, shard, layout.m_count);
+        get_shard_instances().push_back(std::make_unique<session>());
+        session &sql = *get_shard_instances().back();
+        if (!open_database(sql, path, *profile, vm["busy-timeout"].as<int>())) {
+            return EXIT_FAILURE;
+        }
         try {
-            create_database(sql);
+            check_shard_layout(sql, path, layout, shard, cmd == "index" || cmd == "watch");
         } catch (const std::exception &err) {
-            BOOST_LOG_TRIVIAL(info) << "rolling back";
-            sql << "ROLLBACK;";
-            BOOST_LOG_TRIVIAL(fatal) << "Error while creating database(tables): " << err.what();
+            BOOST_LOG_TRIVIAL(fatal) << err.what();
             return EXIT_FAILURE;
         }
     }
 
-
-    string cmd = vm["command"].as<command>().m_name;
-
     if (cmd == "index") {
-        index_files(vm);
+        index_files(vm, layout);
+    } else if (cmd == "watch") {
+        watch_files(vm, database_url);
+    } else if (cmd == "serve") {
+        serve_index(vm, database_url);
+    } else if (cmd == "export") {
+        export_snapshot(vm);
     } else if (cmd == "search") {
-        try{
-            desc.add(search_desc);
-            po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
-            po::notify(vm);
-        } catch(...){
-            cout << "Invalid argument was passed" << endl;
-            printUsage(argv[0], p, desc);
-
+        if(!parse_search_options()){
             return EXIT_FAILURE;
         }
         search_files(vm);
+    } else if (cmd == "dupes") {
+        if(!parse_search_options()){
+            return EXIT_FAILURE;
+        }
+        print_duplicates(cout, vm);
     } else if (cmd == "stat") {
+        if(!parse_search_options()){
+            return EXIT_FAILURE;
+        }
         print_stat(cout, vm);
     }
 }
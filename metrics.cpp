@@ -0,0 +1,173 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <vector>
+
+#include <boost/log/trivial.hpp>
+
+#include <unistd.h>
+
+using std::string;
+
+index_metrics& get_metrics(){
+    static index_metrics metrics;
+    return metrics;
+}
+
+#ifdef OCW_COUNT_ALLOCATIONS
+// The array and nothrow forms of the default library call this one, SQLite allocates with malloc and is not counted.
+void* operator new(std::size_t size){
+    add_metric(get_metrics().m_allocations, 1);
+    if(void *memory = std::malloc(size == 0 ? 1 : size)){
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept{
+    std::free(memory);
+}
+#endif
+
+namespace {
+    // one exported metric, nanosecond timers are exported in seconds
+    struct metric_description{
+        const char *m_name;
+        const char *m_help;
+        const char *m_type;
+        std::atomic<std::uint64_t> index_metrics::*m_value;
+        bool m_nanoseconds;
+    };
+
+    const std::vector<metric_description> metric_descriptions{
+            {"directories_walked_total", "Directories read by the walker", "counter", &index_metrics::m_directories_walked, false},
+            {"files_walked_total", "Files found by the walker", "counter", &index_metrics::m_files_walked, false},
+            {"getdents_calls_total", "getdents64 calls", "counter", &index_metrics::m_getdents_calls, false},
+            {"stat_calls_total", "fstatat calls and io_uring statx requests", "counter", &index_metrics::m_stat_calls, false},
+            {"io_uring_enters_total", "io_uring_enter calls submitting and reaping statx requests", "counter", &index_metrics::m_io_uring_enters, false},
+            {"walk_errors_total", "Directories or files the walker could not read", "counter", &index_metrics::m_walk_errors, false},
+            {"walk_skipped_total", "Files and directories skipped by --exclude, --include, --extension, --max-depth and --one-file-system", "counter", &index_metrics::m_walk_skipped, false},
+            {"walk_seconds_total", "Time spent reading directories, summed over walker threads", "counter", &index_metrics::m_walk_ns, true},
+            {"hashed_files_total", "Files whose content was hashed", "counter", &index_metrics::m_hashed_files, false},
+            {"hashed_bytes_total", "Bytes read for hashing", "counter", &index_metrics::m_hashed_bytes, false},
+            {"hash_seconds_total", "Time spent hashing, summed over walker threads", "counter", &index_metrics::m_hash_ns, true},
+            {"queue_full_seconds_total", "Time walker threads waited for the writer", "counter", &index_metrics::m_queue_full_ns, true},
+            {"queue_batches", "Record batches waiting for the writer", "gauge", &index_metrics::m_queue_batches, false},
+            {"rows_inserted_total", "Files inserted", "counter", &index_metrics::m_rows_inserted, false},
+            {"rows_updated_total", "Files updated", "counter", &index_metrics::m_rows_updated, false},
+            {"rows_deleted_total", "Files deleted", "counter", &index_metrics::m_rows_deleted, false},
+            {"rows_unchanged_total", "Files skipped as unchanged", "counter", &index_metrics::m_rows_unchanged, false},
+            {"rows_failed_total", "Files that could not be written", "counter", &index_metrics::m_rows_failed, false},
+            {"batches_total", "Batches written", "counter", &index_metrics::m_batches, false},
+            {"batch_records_total", "Records written in batches", "counter", &index_metrics::m_batch_records, false},
+            {"batch_max_records", "Records in the largest batch", "gauge", &index_metrics::m_batch_max_records, false},
+            {"sql_seconds_total", "Time spent executing statements of batches", "counter", &index_metrics::m_sql_ns, true},
+            {"commit_seconds_total", "Time spent committing batches", "counter", &index_metrics::m_commit_ns, true},
+            {"writer_idle_seconds_total", "Time the writer waited for the walker", "counter", &index_metrics::m_writer_idle_ns, true},
+#ifdef OCW_COUNT_ALLOCATIONS
+            {"allocations_total", "operator new calls of the process", "counter", &index_metrics::m_allocations, false},
+#endif
+    };
+
+    const char *metric_prefix = "ocw_";
+}
+
+progress_reporter::progress_reporter(std::chrono::milliseconds interval)
+        : m_interval(interval), m_started(std::chrono::steady_clock::now()), m_terminal(isatty(STDERR_FILENO) == 1),
+          m_last_report(m_started), m_thread(&progress_reporter::run, this){}
+
+progress_reporter::~progress_reporter(){
+    stop();
+}
+
+void progress_reporter::stop(){
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stopped){
+            return;
+        }
+        m_stopped = true;
+    }
+    m_wake.notify_all();
+    if(m_thread.joinable()){
+        m_thread.join();
+    }
+}
+
+void progress_reporter::run(){
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(!m_wake.wait_for(lock, m_interval, [this]{ return m_stopped; })){
+        report(false);
+    }
+    report(true);
+}
+
+void progress_reporter::report(bool last){
+    const auto &metrics = get_metrics();
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - m_started).count();
+    const double since_last = std::chrono::duration<double>(now - m_last_report).count();
+    const std::uint64_t files = metrics.m_files_walked.load(std::memory_order_relaxed);
+    const double rate = since_last > 0 ? static_cast<double>(files - m_last_files) / since_last : 0;
+    m_last_files = files;
+    m_last_report = now;
+
+    fprintf(stderr, "%s%.1fs walked %llu files in %llu dirs (%.0f files/s), inserted %llu, updated %llu, "
+                    "deleted %llu, unchanged %llu, queued batches %llu%s",
+            m_terminal ? "\r\033[K" : "", elapsed,
+            static_cast<unsigned long long>(files),
+            static_cast<unsigned long long>(metrics.m_directories_walked.load(std::memory_order_relaxed)),
+            last ? static_cast<double>(files) / (elapsed > 0 ? elapsed : 1) : rate,
+            static_cast<unsigned long long>(metrics.m_rows_inserted.load(std::memory_order_relaxed)),
+            static_cast<unsigned long long>(metrics.m_rows_updated.load(std::memory_order_relaxed)),
+            static_cast<unsigned long long>(metrics.m_rows_deleted.load(std::memory_order_relaxed)),
+            static_cast<unsigned long long>(metrics.m_rows_unchanged.load(std::memory_order_relaxed)),
+            static_cast<unsigned long long>(metrics.m_queue_batches.load(std::memory_order_relaxed)),
+            m_terminal && !last ? "" : "\n");
+    fflush(stderr);
+}
+
+bool write_metrics(const string& path, const string& format){
+    std::ofstream out(path);
+    if(!out){
+        BOOST_LOG_TRIVIAL(error) << "cannot open metrics file " << path;
+        return false;
+    }
+    const auto &metrics = get_metrics();
+    const bool json = format == "json";
+    if(json){
+        out << "{\n";
+    }
+    for (std::size_t i = 0; i < metric_descriptions.size(); ++i) {
+        const auto &description = metric_descriptions[i];
+        const std::uint64_t raw = (metrics.*description.m_value).load(std::memory_order_relaxed);
+        if(json){
+            out << "  \"" << description.m_name << "\": ";
+        } else{
+            out << "# HELP " << metric_prefix << description.m_name << " " << description.m_help << "\n";
+            out << "# TYPE " << metric_prefix << description.m_name << " " << description.m_type << "\n";
+            out << metric_prefix << description.m_name << " ";
+        }
+        if(description.m_nanoseconds){
+            out << static_cast<double>(raw) / 1e9;
+        } else{
+            out << raw;
+        }
+        if(json){
+            out << (i + 1 == metric_descriptions.size() ? "\n" : ",\n");
+        } else{
+            out << "\n";
+        }
+    }
+    if(json){
+        out << "}\n";
+    }
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,110 @@
+#ifndef OS_COURSE_WORK_METRICS_H
+#define OS_COURSE_WORK_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Process wide counters and timers of the indexing pipeline.
+// Walker threads and the writer update them with relaxed atomics, hot loops count into locals
+// and add once per directory or batch, so the cost does not depend on the number of files.
+// Times are summed nanoseconds, walk and hash times are summed over all walker threads.
+struct index_metrics{
+    // walker
+    std::atomic<std::uint64_t> m_directories_walked{0};
+    std::atomic<std::uint64_t> m_files_walked{0};
+    std::atomic<std::uint64_t> m_getdents_calls{0};
+    std::atomic<std::uint64_t> m_stat_calls{0};
+    std::atomic<std::uint64_t> m_io_uring_enters{0};
+    std::atomic<std::uint64_t> m_walk_errors{0};
+    std::atomic<std::uint64_t> m_walk_skipped{0};
+    std::atomic<std::uint64_t> m_walk_ns{0};
+    std::atomic<std::uint64_t> m_hashed_files{0};
+    std::atomic<std::uint64_t> m_hashed_bytes{0};
+    std::atomic<std::uint64_t> m_hash_ns{0};
+    // walkers blocked on a full queue, the writer is the bottleneck when this grows
+    std::atomic<std::uint64_t> m_queue_full_ns{0};
+    std::atomic<std::uint64_t> m_queue_batches{0};
+
+    // writer
+    std::atomic<std::uint64_t> m_rows_inserted{0};
+    std::atomic<std::uint64_t> m_rows_updated{0};
+    std::atomic<std::uint64_t> m_rows_deleted{0};
+    std::atomic<std::uint64_t> m_rows_unchanged{0};
+    std::atomic<std::uint64_t> m_rows_failed{0};
+    std::atomic<std::uint64_t> m_batches{0};
+    std::atomic<std::uint64_t> m_batch_records{0};
+    std::atomic<std::uint64_t> m_batch_max_records{0};
+    std::atomic<std::uint64_t> m_sql_ns{0};
+    std::atomic<std::uint64_t> m_commit_ns{0};
+    // writer waiting for the walkers, the walk is the bottleneck when this grows
+    std::atomic<std::uint64_t> m_writer_idle_ns{0};
+
+    // operator new calls of the whole process, only counted in builds with OCW_COUNT_ALLOCATIONS
+    std::atomic<std::uint64_t> m_allocations{0};
+};
+
+index_metrics& get_metrics();
+
+inline void add_metric(std::atomic<std::uint64_t>& metric, std::uint64_t value){
+    metric.fetch_add(value, std::memory_order_relaxed);
+}
+
+inline void max_metric(std::atomic<std::uint64_t>& metric, std::uint64_t value){
+    std::uint64_t current = metric.load(std::memory_order_relaxed);
+    while(current < value && !metric.compare_exchange_weak(current, value, std::memory_order_relaxed)){}
+}
+
+// adds the time between construction and destruction to a nanosecond metric
+class metrics_timer{
+public:
+    explicit metrics_timer(std::atomic<std::uint64_t>& target_ns)
+            : m_target(target_ns), m_started(std::chrono::steady_clock::now()){}
+    ~metrics_timer(){
+        add_metric(m_target, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - m_started).count()));
+    }
+
+    metrics_timer(const metrics_timer&) = delete;
+    metrics_timer& operator=(const metrics_timer&) = delete;
+
+private:
+    std::atomic<std::uint64_t>& m_target;
+    std::chrono::steady_clock::time_point m_started;
+};
+
+// Prints a progress line to stderr every interval until stopped.
+// On a terminal the line is redrawn in place, otherwise every report is a line of its own.
+class progress_reporter{
+public:
+    explicit progress_reporter(std::chrono::milliseconds interval);
+    ~progress_reporter();
+
+    progress_reporter(const progress_reporter&) = delete;
+    progress_reporter& operator=(const progress_reporter&) = delete;
+
+    void stop();
+
+private:
+    void run();
+    void report(bool last);
+
+    std::chrono::milliseconds m_interval;
+    std::chrono::steady_clock::time_point m_started;
+    bool m_terminal;
+    std::uint64_t m_last_files = 0;
+    std::chrono::steady_clock::time_point m_last_report;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopped = false;
+    std::thread m_thread;
+};
+
+// writes all metrics in Prometheus text format or as JSON, format is "prometheus" or "json"
+bool write_metrics(const std::string& path, const std::string& format);
+
+#endif //OS_COURSE_WORK_METRICS_H
@@ -0,0 +1,174 @@
+#include "result_writer.h"
+
+#include <charconv>
+
+using std::string_view;
+
+// results are collected up to this size before they are written
+static const std::size_t result_buffer_size = 64 * 1024;
+
+bool parse_output_format(const std::string& name, output_format& format){
+    if(name == "text"){
+        format = output_format::text;
+    } else if(name == "plain"){
+        format = output_format::plain;
+    } else if(name == "null"){
+        format = output_format::null;
+    } else if(name == "json"){
+        format = output_format::json;
+    } else if(name == "csv"){
+        format = output_format::csv;
+    } else{
+        return false;
+    }
+    return true;
+}
+
+result_writer::result_writer(std::ostream& out, output_options options): m_out(out), m_options(options){
+    m_buffer.reserve(result_buffer_size + 4096);
+    if(m_options.m_format == output_format::csv && !m_options.m_count_only){
+        append("path,size,changed\n");
+    }
+}
+
+result_writer::~result_writer(){
+    finish();
+}
+
+bool result_writer::add(string_view directory, string_view name, long long size, long long changed){
+    if(full()){
+        return false;
+    }
+    ++m_count;
+    if(m_options.m_count_only){
+        return !full();
+    }
+    switch (m_options.m_format) {
+        case output_format::text:
+            append("Found file: ");
+            append_path(directory, name);
+            m_buffer += '\n';
+            break;
+        case output_format::plain:
+            append_path(directory, name);
+            m_buffer += '\n';
+            break;
+        case output_format::null:
+            append_path(directory, name);
+            m_buffer += '\0';
+            break;
+        case output_format::json:
+            append("{\"path\":");
+            append_json_string(directory, name);
+            append(",\"size\":");
+            append_number(size);
+            append(",\"changed\":");
+            append_number(changed);
+            append("}\n");
+            break;
+        case output_format::csv:
+            append_csv_field(directory, name);
+            m_buffer += ',';
+            append_number(size);
+            m_buffer += ',';
+            append_number(changed);
+            m_buffer += '\n';
+            break;
+    }
+    if(m_buffer.size() >= result_buffer_size){
+        flush();
+    }
+    return !full();
+}
+
+void result_writer::add_counted(std::uint64_t files){
+    m_count += files;
+    if(m_options.m_limit != 0 && m_count > m_options.m_limit){
+        m_count = m_options.m_limit;
+    }
+}
+
+void result_writer::finish(){
+    if(m_finished){
+        return;
+    }
+    m_finished = true;
+    if(m_options.m_count_only){
+        append_number(static_cast<long long>(m_count));
+        m_buffer += '\n';
+    }
+    flush();
+    m_out.flush();
+}
+
+void result_writer::append_path(string_view directory, string_view name){
+    append(directory);
+    if(directory != "/"){
+        m_buffer += '/';
+    }
+    append(name);
+}
+
+void result_writer::append_number(long long value){
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    m_buffer.append(digits, static_cast<std::size_t>(result.ptr - digits));
+}
+
+void result_writer::append_json_string(string_view directory, string_view name){
+    // names are written as their bytes, only quotes, backslashes and control characters are escaped
+    static const char hex[] = "0123456789abcdef";
+    auto escape = [this](string_view text){
+        for (char c : text) {
+            const auto byte = static_cast<unsigned char>(c);
+            if(c == '"' || c == '\\'){
+                m_buffer += '\\';
+                m_buffer += c;
+            } else if(byte < 0x20){
+                append("\\u00");
+                m_buffer += hex[byte >> 4];
+                m_buffer += hex[byte & 0xF];
+            } else{
+                m_buffer += c;
+            }
+        }
+    };
+    m_buffer += '"';
+    escape(directory);
+    if(directory != "/"){
+        m_buffer += '/';
+    }
+    escape(name);
+    m_buffer += '"';
+}
+
+void result_writer::append_csv_field(string_view directory, string_view name){
+    // quoted only when needed, like RFC 4180
+    auto needs_quotes = [](string_view text){ return text.find_first_of(",\"\r\n") != string_view::npos; };
+    if(!needs_quotes(directory) && !needs_quotes(name)){
+        append_path(directory, name);
+        return;
+    }
+    auto quote = [this](string_view text){
+        for (char c : text) {
+            if(c == '"'){
+                m_buffer += '"';
+            }
+            m_buffer += c;
+        }
+    };
+    m_buffer += '"';
+    quote(directory);
+    if(directory != "/"){
+        m_buffer += '/';
+    }
+    quote(name);
+    m_buffer += '"';
+}
+
+void result_writer::flush(){
+    if(!m_buffer.empty()){
+        m_out.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+        m_buffer.clear();
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef OS_COURSE_WORK_RESULT_WRITER_H
+#define OS_COURSE_WORK_RESULT_WRITER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// text: "Found file: <path>" lines, plain: one path per line, null: paths ended by NUL for xargs -0,
+// json: one object per line with path, size and changed(ns since epoch), csv: a header and one row per file
+enum class output_format{
+    text,
+    plain,
+    null,
+    json,
+    csv
+};
+
+bool parse_output_format(const std::string& name, output_format& format);
+
+struct output_options{
+    output_format m_format = output_format::text;
+    // 0 is no limit
+    std::uint64_t m_limit = 0;
+    // only the number of found files is written
+    bool m_count_only = false;
+
+    // only json and csv print the size and the change time
+    bool with_details() const {
+        return !m_count_only && (m_format == output_format::json || m_format == output_format::csv);
+    }
+};
+
+// Formats search results into a buffer that goes to the stream in large writes,
+// nothing is allocated per result. Flushed by finish() or the destructor.
+class result_writer{
+public:
+    result_writer(std::ostream& out, output_options options);
+    ~result_writer();
+
+    result_writer(const result_writer&) = delete;
+    result_writer& operator=(const result_writer&) = delete;
+
+    // false once the limit is reached, the caller stops looking
+    bool add(std::string_view directory, std::string_view name, long long size, long long changed);
+    // files counted somewhere else, e.g. by SELECT COUNT(*)
+    void add_counted(std::uint64_t files);
+    bool full() const { return m_options.m_limit != 0 && m_count >= m_options.m_limit; }
+    std::uint64_t count() const { return m_count; }
+    // writes the count of count-only output and flushes, later calls do nothing
+    void finish();
+
+private:
+    void append(std::string_view text){ m_buffer.append(text.data(), text.size()); }
+    void append_path(std::string_view directory, std::string_view name);
+    void append_number(long long value);
+    void append_json_string(std::string_view directory, std::string_view name);
+    void append_csv_field(std::string_view directory, std::string_view name);
+    void flush();
+
+    std::ostream &m_out;
+    output_options m_options;
+    std::string m_buffer;
+    std::uint64_t m_count = 0;
+    bool m_finished = false;
+};
+
+#endif //OS_COURSE_WORK_RESULT_WRITER_H
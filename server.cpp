@@ -0,0 +1,340 @@
+#include "server.h"
+#include "helpers.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <streambuf>
+#include <system_error>
+
+#include <boost/log/trivial.hpp>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace soci;
+using std::string;
+using std::vector;
+
+static const std::size_t client_read_size = 64 * 1024;
+// a request is a few options, a longer line is not a request
+static const std::size_t max_request_size = 64 * 1024;
+
+namespace {
+    sockaddr_un socket_address(const string& path){
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if(path.size() >= sizeof(address.sun_path)){
+            throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    // a socket file left by a server that did not stop cleanly is removed, one of a running server is not
+    void remove_stale_socket(const string& path){
+        struct stat sb;
+        if(lstat(path.c_str(), &sb) != 0 || !S_ISSOCK(sb.st_mode)){
+            return;
+        }
+        const auto address = socket_address(path);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const bool running = fd != -1 && connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+        if(fd != -1){
+            close(fd);
+        }
+        if(running){
+            throw std::system_error(EADDRINUSE, std::generic_category(), path);
+        }
+        BOOST_LOG_TRIVIAL(info) << "removing stale socket " << path;
+        unlink(path.c_str());
+    }
+
+    // an ostream appending to a string, so answers are written where they are sent from
+    class string_appender: public std::streambuf{
+    public:
+        explicit string_appender(string& target): m_target(target){}
+
+    protected:
+        int_type overflow(int_type c) override{
+            if(c != traits_type::eof()){
+                m_target += traits_type::to_char_type(c);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char* data, std::streamsize count) override{
+            m_target.append(data, static_cast<std::size_t>(count));
+            return count;
+        }
+
+    private:
+        string &m_target;
+    };
+
+    // fills `query` and `output` from the tab separated options of a request
+    bool parse_request(const vector<string>& fields, view_query& query, output_options& output, string& error){
+        for (std::size_t i = 1; i < fields.size(); ++i) {
+            const auto &field = fields[i];
+            const auto equals = field.find('=');
+            const string key = field.substr(0, equals);
+            const string value = equals == string::npos ? string() : field.substr(equals + 1);
+            long long number;
+            if(key == "by"){
+                query.m_by = value;
+            } else if(key == "target"){
+                query.m_target = value;
+            } else if(key == "min" || key == "max"){
+                if(!parse_size(value, number)){
+                    error = "Invalid size: " + value;
+                    return false;
+                }
+                (key == "min" ? query.m_min_size : query.m_max_size) = number;
+            } else if(key == "changed-after" || key == "changed-before"){
+                if(!parse_datetime(value, number)){
+                    error = "Invalid date: " + value;
+                    return false;
+                }
+                (key == "changed-after" ? query.m_changed_after : query.m_changed_before) = number;
+            } else if(key == "regex" || key == "recursive"){
+                (key == "regex" ? query.m_regex : query.m_recursive) = value != "0" && value != "false";
+            } else if(key == "depth"){
+                try{
+                    query.m_depth = std::stoi(value);
+                } catch (const std::exception&){
+                    error = "Invalid depth: " + value;
+                    return false;
+                }
+            } else if(key == "format"){
+                if(!parse_output_format(value, output.m_format)){
+                    error = "Invalid format: " + value;
+                    return false;
+                }
+            } else if(key == "limit"){
+                try{
+                    output.m_limit = std::stoull(value);
+                } catch (const std::exception&){
+                    error = "Invalid limit: " + value;
+                    return false;
+                }
+            } else if(key == "count-only"){
+                output.m_count_only = value != "0" && value != "false";
+            } else{
+                error = "Unknown option: " + key;
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+index_server::index_server(session& sql, string socket_path): m_sql(sql), m_socket_path(std::move(socket_path)){
+    m_data_version = read_data_version();
+    m_index = std::make_unique<memory_index>();
+    m_index->load(m_sql);
+
+    const auto address = socket_address(m_socket_path);
+    remove_stale_socket(m_socket_path);
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(m_fd == -1){
+        throw std::system_error(errno, std::generic_category(), "socket");
+    }
+    if(bind(m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(m_fd, SOMAXCONN) != 0){
+        const int error = errno;
+        close(m_fd);
+        throw std::system_error(error, std::generic_category(), m_socket_path);
+    }
+}
+
+index_server::~index_server(){
+    for (auto &client : m_clients) {
+        close(client.m_fd);
+    }
+    if(m_fd != -1){
+        close(m_fd);
+        unlink(m_socket_path.c_str());
+    }
+}
+
+int index_server::read_data_version(){
+    int version = 0;
+    m_sql << "PRAGMA data_version;", into(version);
+    return version;
+}
+
+bool index_server::reload_if_changed(){
+    const int version = read_data_version();
+    if(version == m_data_version){
+        return false;
+    }
+    BOOST_LOG_TRIVIAL(info) << "database changed, loading the index again";
+    // the old index keeps answering if loading fails
+    auto index = std::make_unique<memory_index>();
+    index->load(m_sql);
+    m_index = std::move(index);
+    m_data_version = version;
+    return true;
+}
+
+void index_server::wait(std::chrono::milliseconds timeout){
+    vector<pollfd> fds;
+    fds.push_back({m_fd, POLLIN, 0});
+    for (const auto &client : m_clients) {
+        short events = 0;
+        if(client.m_output.empty() && !client.m_closing){
+            events |= POLLIN;
+        }
+        if(!client.m_output.empty()){
+            events |= POLLOUT;
+        }
+        fds.push_back({client.m_fd, events, 0});
+    }
+    int ready = poll(fds.data(), fds.size(), static_cast<int>(timeout.count()));
+    if(ready <= 0){
+        if(ready == -1 && errno != EINTR){
+            BOOST_LOG_TRIVIAL(error) << "poll failed: " << strerror(errno);
+        }
+        return;
+    }
+    // clients accepted below are polled from the next wait on
+    vector<client> alive;
+    for (std::size_t i = 0; i < m_clients.size(); ++i) {
+        auto &client = m_clients[i];
+        const short revents = fds[i + 1].revents;
+        bool open = true;
+        if(revents & POLLIN){
+            open = read_requests(client);
+        } else if(revents != 0 && client.m_output.empty()){
+            // hung up or failed without anything to read or send
+            close(client.m_fd);
+            open = false;
+        }
+        // new answers are sent right away, most fit in the socket buffer without waiting for POLLOUT
+        if(open && !client.m_output.empty()){
+            open = send_answers(client);
+        }
+        if(open){
+            alive.push_back(std::move(client));
+        }
+    }
+    m_clients = std::move(alive);
+    if(fds[0].revents & POLLIN){
+        accept_clients();
+    }
+}
+
+void index_server::accept_clients(){
+    while(true){
+        int fd = accept4(m_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == -1){
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                BOOST_LOG_TRIVIAL(error) << "accept failed: " << strerror(errno);
+            }
+            return;
+        }
+        BOOST_LOG_TRIVIAL(debug) << "client connected";
+        m_clients.push_back({fd, string(), string()});
+    }
+}
+
+bool index_server::read_requests(client& client){
+    char buffer[client_read_size];
+    ssize_t read_bytes = recv(client.m_fd, buffer, sizeof(buffer), 0);
+    if(read_bytes == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)){
+        return true;
+    }
+    if(read_bytes <= 0){
+        BOOST_LOG_TRIVIAL(debug) << "client disconnected";
+        close(client.m_fd);
+        return false;
+    }
+    client.m_input.append(buffer, static_cast<std::size_t>(read_bytes));
+    std::size_t start = 0;
+    for (auto end = client.m_input.find('\n'); end != string::npos; end = client.m_input.find('\n', start)) {
+        string request = client.m_input.substr(start, end - start);
+        start = end + 1;
+        if(!request.empty() && request.back() == '\r'){
+            request.pop_back();
+        }
+        answer(request, client.m_output);
+    }
+    client.m_input.erase(0, start);
+    if(client.m_input.size() > max_request_size){
+        client.m_output += "error Request too long\n";
+        client.m_closing = true;
+    }
+    return true;
+}
+
+bool index_server::send_answers(client& client){
+    while(client.m_sent < client.m_output.size()){
+        ssize_t written = send(client.m_fd, client.m_output.data() + client.m_sent,
+                               client.m_output.size() - client.m_sent, MSG_NOSIGNAL);
+        if(written == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                return true;
+            }
+            BOOST_LOG_TRIVIAL(debug) << "cannot answer client: " << strerror(errno);
+            close(client.m_fd);
+            return false;
+        }
+        client.m_sent += static_cast<std::size_t>(written);
+    }
+    client.m_output.clear();
+    client.m_sent = 0;
+    if(client.m_closing){
+        close(client.m_fd);
+        return false;
+    }
+    return true;
+}
+
+void index_server::answer(const string& request, string& output){
+    const auto started = std::chrono::steady_clock::now();
+    ++m_requests_count;
+    vector<string> fields;
+    std::size_t start = 0;
+    for (auto tab = request.find('\t'); ; tab = request.find('\t', start)) {
+        fields.push_back(request.substr(start, tab - start));
+        if(tab == string::npos){
+            break;
+        }
+        start = tab + 1;
+    }
+
+    view_query query;
+    output_options options;
+    string error;
+    // the text goes straight after the answers before it, its header is inserted in front once its size is known
+    const std::size_t text_start = output.size();
+    bool ok = parse_request(fields, query, options, error);
+    if(ok){
+        string_appender appender(output);
+        std::ostream out(&appender);
+        if(fields[0] == "search"){
+            result_writer writer(out, options);
+            ok = search_view(m_index->view(), query, writer, error);
+        } else if(fields[0] == "stat"){
+            ok = stat_view(m_index->view(), query, out, error);
+        } else{
+            error = "Unknown command: " + fields[0];
+            ok = false;
+        }
+    }
+    BOOST_LOG_TRIVIAL(debug) << "answered " << std::quoted(request) << " in "
+                             << std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now() - started).count() << "us";
+    if(!ok){
+        output.resize(text_start);
+        output += "error " + error + "\n";
+        return;
+    }
+    output.insert(text_start, "ok " + std::to_string(output.size() - text_start) + "\n");
+}
@@ -0,0 +1,66 @@
+#ifndef OS_COURSE_WORK_SERVER_H
+#define OS_COURSE_WORK_SERVER_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <soci/soci.h>
+
+#include "index_view.h"
+
+// Answers search and stat from a memory_index over a Unix domain socket, one process serves many lookups.
+// A request is one line: the command, "search" or "stat", and options like on the command line,
+// separated by tabs, e.g. "search\tby=name\ttarget=report\tmin=1M". Switches like "recursive" have no value.
+// The response is "ok <bytes>\n" followed by exactly that many bytes of output, or "error <message>\n".
+// Clients may send any number of requests on one connection, they are answered in order.
+class index_server{
+public:
+    // loads the index and listens on `socket_path`, throws std::system_error if the socket can not be bound
+    index_server(soci::session& sql, std::string socket_path);
+    ~index_server();
+
+    index_server(const index_server&) = delete;
+    index_server& operator=(const index_server&) = delete;
+
+    // waits up to `timeout` for connections and requests and answers them, returns early after answering
+    void wait(std::chrono::milliseconds timeout);
+    // loads the index again if another connection committed to the database since the last load
+    bool reload_if_changed();
+
+    const memory_index& index() const { return *m_index; }
+    std::size_t requests_count() const { return m_requests_count; }
+
+private:
+    // Client sockets are non-blocking, a client that does not read its answers only holds up itself.
+    // Its further requests are not read while answers to it wait to be sent.
+    struct client{
+        int m_fd;
+        // received bytes that do not form a whole request yet
+        std::string m_input;
+        // answers not sent yet, m_output[0, m_sent) is sent already
+        std::string m_output;
+        std::size_t m_sent = 0;
+        // closed once m_output is sent
+        bool m_closing = false;
+    };
+
+    void accept_clients();
+    // both return false when the client is gone or misbehaved and was closed
+    bool read_requests(client& client);
+    bool send_answers(client& client);
+    // appends the response to `output`, the result is written into it directly
+    void answer(const std::string& request, std::string& output);
+    int read_data_version();
+
+    soci::session &m_sql;
+    std::string m_socket_path;
+    int m_fd = -1;
+    std::vector<client> m_clients;
+    std::unique_ptr<memory_index> m_index;
+    int m_data_version = 0;
+    std::size_t m_requests_count = 0;
+};
+
+#endif //OS_COURSE_WORK_SERVER_H
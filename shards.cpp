@@ -0,0 +1,127 @@
+#include "shards.h"
+#include "helpers.h"
+#include "index_writer.h"
+
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+
+namespace fs = std::filesystem;
+using namespace soci;
+using std::string;
+using std::vector;
+
+bool parse_shard_by(const string& name, shard_by& by){
+    if(name == "root"){
+        by = shard_by::root;
+    } else if(name == "hash"){
+        by = shard_by::hash;
+    } else{
+        return false;
+    }
+    return true;
+}
+
+const char* shard_by_name(shard_by by){
+    return by == shard_by::hash ? "hash" : "root";
+}
+
+string shard_database_path(const string& database, unsigned shard, unsigned count){
+    if(count == 1){
+        return database;
+    }
+    const fs::path path(database);
+    auto name = path.stem().string() + "." + std::to_string(shard) + path.extension().string();
+    return (path.parent_path() / name).string();
+}
+
+void check_shard_layout(session& sql, const string& path, const shard_layout& layout, unsigned shard, bool writing){
+    int stored_index = 0, stored_count = 0;
+    string stored_by;
+    sql << "SELECT shard_index, shard_count, shard_by FROM `shard_layout`;",
+            into(stored_index), into(stored_count), into(stored_by);
+    if(!sql.got_data()){
+        // a plain database, or a shard nothing was written to yet
+        if(layout.m_count > 1 && writing){
+            const int index = static_cast<int>(shard), count = static_cast<int>(layout.m_count);
+            const string by = shard_by_name(layout.m_by);
+            sql << "INSERT INTO `shard_layout`(shard_index, shard_count, shard_by) VALUES (:index, :count, :by);",
+                    use(index, "index"), use(count, "count"), use(by, "by");
+        }
+        return;
+    }
+    if(stored_count != static_cast<int>(layout.m_count) || stored_index != static_cast<int>(shard)){
+        throw std::runtime_error(path + " is shard " + std::to_string(stored_index) + " of " +
+                                 std::to_string(stored_count) + ", pass --shards=" + std::to_string(stored_count) +
+                                 " with the database file the shards were made from");
+    }
+    if(writing && stored_by != shard_by_name(layout.m_by)){
+        throw std::runtime_error(path + " is sharded by " + stored_by + ", pass --shard-by=" + stored_by);
+    }
+}
+
+shard_router::shard_router(shard_layout layout, vector<string> roots): m_layout(layout), m_roots(std::move(roots)){
+}
+
+unsigned shard_router::shard_of(const file_record& record) const{
+    if(m_layout.m_count == 1){
+        return 0;
+    }
+    if(m_layout.m_by == shard_by::hash){
+        return shard_of_path(record.m_directory);
+    }
+    for (const auto &root : m_roots) {
+        const auto bounds = subtree_bounds(root);
+        if(record.m_directory == root || (record.m_directory >= bounds.first && record.m_directory < bounds.second)){
+            return shard_of_path(root);
+        }
+    }
+    // a root that is a file itself
+    string path(record.m_directory == "/" ? "" : record.m_directory);
+    path += '/';
+    path += record.m_filename;
+    return shard_of_path(path);
+}
+
+unsigned shard_router::shard_of_root(const string& root) const{
+    return m_layout.m_count == 1 ? 0 : shard_of_path(root);
+}
+
+unsigned shard_router::shard_of_path(std::string_view path) const{
+    // FNV-1a, std::hash may differ between builds and the shard of a path must not
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (char c : path) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return static_cast<unsigned>(hash % m_layout.m_count);
+}
+
+void run_on_shards(unsigned count, const std::function<void(unsigned)>& work){
+    if(count == 1){
+        work(0);
+        return;
+    }
+    vector<std::exception_ptr> errors(count);
+    vector<std::thread> threads;
+    threads.reserve(count);
+    for (unsigned i = 0; i < count; ++i) {
+        threads.emplace_back([&work, &errors, i]{
+            try{
+                work(i);
+            } catch (...){
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const auto &error : errors) {
+        if(error){
+            std::rethrow_exception(error);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef OS_COURSE_WORK_SHARDS_H
+#define OS_COURSE_WORK_SHARDS_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <soci/soci.h>
+
+struct file_record;
+
+// root: every index root goes whole to one shard, hash: the files of a directory go to the shard of its path hash
+enum class shard_by{
+    root,
+    hash
+};
+
+bool parse_shard_by(const std::string& name, shard_by& by);
+const char* shard_by_name(shard_by by);
+
+// how an index is split into database files, one shard is a plain database
+struct shard_layout{
+    unsigned m_count = 1;
+    shard_by m_by = shard_by::root;
+};
+
+// "index.sqlite" is split into "index.0.sqlite", "index.1.sqlite", ..., one shard keeps the path as is
+std::string shard_database_path(const std::string& database, unsigned shard, unsigned count);
+
+// Checks that the database is shard `shard` of `layout`, a shard remembers its layout the first time it is written.
+// Reading commands do not check shard_by, it only matters for where new files go.
+// Throws std::runtime_error on a mismatch.
+void check_shard_layout(soci::session& sql, const std::string& path, const shard_layout& layout, unsigned shard,
+                        bool writing);
+
+// Picks the shard of every walked file, the same file always lands in the same shard for the same layout and roots.
+class shard_router{
+public:
+    // `roots` are the walked roots without nested ones
+    shard_router(shard_layout layout, std::vector<std::string> roots);
+
+    unsigned shard_of(const file_record& record) const;
+    unsigned shard_of_root(const std::string& root) const;
+    unsigned count() const { return m_layout.m_count; }
+
+private:
+    unsigned shard_of_path(std::string_view path) const;
+
+    shard_layout m_layout;
+    std::vector<std::string> m_roots;
+};
+
+// calls `work` for every shard, on its own thread when there is more than one,
+// the first exception thrown by any of them is thrown again after all are done
+void run_on_shards(unsigned count, const std::function<void(unsigned)>& work);
+
+#endif //OS_COURSE_WORK_SHARDS_H
@@ -0,0 +1,273 @@
+#include "snapshot.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace {
+    const char snapshot_magic[8] = {'O', 'C', 'W', 'S', 'N', 'A', 'P', '\0'};
+    const uint32_t snapshot_version = 1;
+    // read back as another value on a machine with the other byte order
+    const uint32_t snapshot_byte_order = 0x01020304;
+    const uint64_t snapshot_alignment = 8;
+
+    // the arrays of index_view in file order
+    enum snapshot_section{
+        strings_section,
+        directory_name_section,
+        directory_parent_section,
+        directory_subtree_end_section,
+        directory_depth_section,
+        directory_files_section,
+        file_name_section,
+        file_size_section,
+        file_changed_section,
+        size_prefix_section,
+        name_order_section,
+        size_order_section,
+        changed_order_section,
+        extension_name_section,
+        extension_files_section,
+        extension_file_ids_section,
+        sections_count
+    };
+
+    struct snapshot_header{
+        char m_magic[8];
+        uint32_t m_version;
+        uint32_t m_byte_order;
+        uint32_t m_directories_count;
+        uint32_t m_files_count;
+        uint32_t m_extensions_count;
+        uint32_t m_reserved;
+        uint64_t m_offsets[sections_count];
+        uint64_t m_sizes[sections_count];
+    };
+
+    uint64_t aligned(uint64_t offset){
+        return (offset + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+    }
+
+    struct section_data{
+        const void *m_data;
+        uint64_t m_size;
+    };
+
+    template<class T>
+    section_data section(const T* data, uint64_t count){
+        return {data, count * sizeof(T)};
+    }
+
+    [[noreturn]] void damaged(snapshot_section id){
+        throw std::runtime_error("snapshot section " + std::to_string(id) + " is damaged");
+    }
+
+    // points `target` at a section after checking it holds `count` values inside the file
+    template<class T>
+    void bind_section(const T*& target, const snapshot_header& header, snapshot_section id, uint64_t count,
+                      const char* data, uint64_t file_size){
+        const uint64_t offset = header.m_offsets[id], size = header.m_sizes[id];
+        if(size != count * sizeof(T) || offset % snapshot_alignment != 0 || offset > file_size || size > file_size - offset){
+            damaged(id);
+        }
+        target = reinterpret_cast<const T*>(data + offset);
+    }
+
+    void check_strings(const index_view& view, const string_ref* refs, uint64_t count, snapshot_section id){
+        for (uint64_t i = 0; i < count; ++i) {
+            if(refs[i].m_offset > view.m_strings_size || refs[i].m_length > view.m_strings_size - refs[i].m_offset){
+                damaged(id);
+            }
+        }
+    }
+
+    void check_indexes(const uint32_t* indexes, uint64_t count, uint64_t limit, snapshot_section id){
+        for (uint64_t i = 0; i < count; ++i) {
+            if(indexes[i] >= limit){
+                damaged(id);
+            }
+        }
+    }
+
+    // ascending offsets from 0 to `total`, like directory_files and extension_files
+    void check_ranges(const uint32_t* offsets, uint64_t count, uint64_t total, snapshot_section id){
+        if(offsets[0] != 0 || offsets[count] != total){
+            damaged(id);
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            if(offsets[i] > offsets[i + 1]){
+                damaged(id);
+            }
+        }
+    }
+
+    // Everything a query uses as an index, so a damaged file is rejected instead of being read outside
+    // of the mapping. Parents come before their children and subtrees end after them, so walking up
+    // or across directories always ends. Reads every page of the file.
+    void check_view(const index_view& view){
+        const uint64_t directories = view.m_directories_count, files = view.m_files_count,
+                extensions = view.m_extensions_count;
+        check_strings(view, view.m_directory_name, directories, directory_name_section);
+        check_strings(view, view.m_file_name, files, file_name_section);
+        check_strings(view, view.m_extension_name, extensions, extension_name_section);
+        for (uint64_t d = 0; d < directories; ++d) {
+            if(view.m_directory_parent[d] != no_directory && view.m_directory_parent[d] >= d){
+                damaged(directory_parent_section);
+            }
+            if(view.m_directory_subtree_end[d] <= d || view.m_directory_subtree_end[d] > directories){
+                damaged(directory_subtree_end_section);
+            }
+        }
+        check_ranges(view.m_directory_files, directories, files, directory_files_section);
+        check_ranges(view.m_extension_files, extensions, files, extension_files_section);
+        check_indexes(view.m_name_order, files, files, name_order_section);
+        check_indexes(view.m_size_order, files, files, size_order_section);
+        check_indexes(view.m_changed_order, files, files, changed_order_section);
+        check_indexes(view.m_extension_file_ids, files, files, extension_file_ids_section);
+    }
+}
+
+void write_snapshot(const index_view& view, const string& path){
+    const uint64_t directories = view.m_directories_count, files = view.m_files_count,
+            extensions = view.m_extensions_count;
+    section_data sections[sections_count] = {
+            {view.m_strings, view.m_strings_size},
+            section(view.m_directory_name, directories),
+            section(view.m_directory_parent, directories),
+            section(view.m_directory_subtree_end, directories),
+            section(view.m_directory_depth, directories),
+            section(view.m_directory_files, directories + 1),
+            section(view.m_file_name, files),
+            section(view.m_file_size, files),
+            section(view.m_file_changed, files),
+            section(view.m_size_prefix, files + 1),
+            section(view.m_name_order, files),
+            section(view.m_size_order, files),
+            section(view.m_changed_order, files),
+            section(view.m_extension_name, extensions),
+            section(view.m_extension_files, extensions + 1),
+            section(view.m_extension_file_ids, files),
+    };
+
+    snapshot_header header{};
+    std::memcpy(header.m_magic, snapshot_magic, sizeof(snapshot_magic));
+    header.m_version = snapshot_version;
+    header.m_byte_order = snapshot_byte_order;
+    header.m_directories_count = view.m_directories_count;
+    header.m_files_count = view.m_files_count;
+    header.m_extensions_count = view.m_extensions_count;
+    uint64_t offset = aligned(sizeof(header));
+    for (int i = 0; i < sections_count; ++i) {
+        header.m_offsets[i] = offset;
+        header.m_sizes[i] = sections[i].m_size;
+        offset = aligned(offset + sections[i].m_size);
+    }
+
+    const string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        const char padding[snapshot_alignment] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t written = sizeof(header);
+        for (int i = 0; i < sections_count; ++i) {
+            out.write(padding, static_cast<std::streamsize>(header.m_offsets[i] - written));
+            out.write(static_cast<const char*>(sections[i].m_data), static_cast<std::streamsize>(sections[i].m_size));
+            written = header.m_offsets[i] + sections[i].m_size;
+        }
+        out.flush();
+        if(!out){
+            std::remove(temporary.c_str());
+            throw std::runtime_error("cannot write snapshot " + temporary);
+        }
+    }
+    if(std::rename(temporary.c_str(), path.c_str()) != 0){
+        const int error = errno;
+        std::remove(temporary.c_str());
+        throw std::system_error(error, std::generic_category(), path);
+    }
+}
+
+snapshot_file::snapshot_file(const string& path, bool verify){
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1){
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    struct stat sb;
+    if(fstat(fd, &sb) != 0){
+        const int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+    m_size = static_cast<std::size_t>(sb.st_size);
+    if(m_size < sizeof(snapshot_header)){
+        close(fd);
+        throw std::runtime_error(path + " is not a snapshot");
+    }
+    m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const int map_error = errno;
+    close(fd);
+    if(m_data == MAP_FAILED){
+        m_data = nullptr;
+        throw std::system_error(map_error, std::generic_category(), path);
+    }
+
+    const char *data = static_cast<const char*>(m_data);
+    snapshot_header header;
+    std::memcpy(&header, data, sizeof(header));
+    try{
+        if(std::memcmp(header.m_magic, snapshot_magic, sizeof(snapshot_magic)) != 0){
+            throw std::runtime_error(path + " is not a snapshot");
+        }
+        if(header.m_version != snapshot_version || header.m_byte_order != snapshot_byte_order){
+            throw std::runtime_error(path + " was written by another version or machine, export it again");
+        }
+        const uint64_t directories = header.m_directories_count, files = header.m_files_count,
+                extensions = header.m_extensions_count;
+        m_view.m_directories_count = header.m_directories_count;
+        m_view.m_files_count = header.m_files_count;
+        m_view.m_extensions_count = header.m_extensions_count;
+        m_view.m_strings_size = header.m_sizes[strings_section];
+        bind_section(m_view.m_strings, header, strings_section, m_view.m_strings_size, data, m_size);
+        bind_section(m_view.m_directory_name, header, directory_name_section, directories, data, m_size);
+        bind_section(m_view.m_directory_parent, header, directory_parent_section, directories, data, m_size);
+        bind_section(m_view.m_directory_subtree_end, header, directory_subtree_end_section, directories, data, m_size);
+        bind_section(m_view.m_directory_depth, header, directory_depth_section, directories, data, m_size);
+        bind_section(m_view.m_directory_files, header, directory_files_section, directories + 1, data, m_size);
+        bind_section(m_view.m_file_name, header, file_name_section, files, data, m_size);
+        bind_section(m_view.m_file_size, header, file_size_section, files, data, m_size);
+        bind_section(m_view.m_file_changed, header, file_changed_section, files, data, m_size);
+        bind_section(m_view.m_size_prefix, header, size_prefix_section, files + 1, data, m_size);
+        bind_section(m_view.m_name_order, header, name_order_section, files, data, m_size);
+        bind_section(m_view.m_size_order, header, size_order_section, files, data, m_size);
+        bind_section(m_view.m_changed_order, header, changed_order_section, files, data, m_size);
+        bind_section(m_view.m_extension_name, header, extension_name_section, extensions, data, m_size);
+        bind_section(m_view.m_extension_files, header, extension_files_section, extensions + 1, data, m_size);
+        bind_section(m_view.m_extension_file_ids, header, extension_file_ids_section, files, data, m_size);
+        if(verify){
+            check_view(m_view);
+        }
+    } catch (...){
+        munmap(m_data, m_size);
+        throw;
+    }
+}
+
+snapshot_file::~snapshot_file(){
+    if(m_data != nullptr){
+        munmap(m_data, m_size);
+    }
+}
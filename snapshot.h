@@ -0,0 +1,35 @@
+#ifndef OS_COURSE_WORK_SNAPSHOT_H
+#define OS_COURSE_WORK_SNAPSHOT_H
+
+#include <cstddef>
+#include <string>
+
+#include "index_view.h"
+
+// An immutable file with the arrays of an index_view, search and stat map it and use it in place,
+// only the header is read at startup. The layout is a header with the offset and size of every
+// array followed by the arrays, each 8 byte aligned, in the byte order of the machine that wrote it.
+// Written to a temporary file and renamed, so readers never see half of a snapshot.
+void write_snapshot(const index_view& view, const std::string& path);
+
+class snapshot_file{
+public:
+    // Maps the file, throws std::runtime_error if it is not a snapshot of this version or a section
+    // does not fit in the file. With `verify` every string and index in the arrays is checked too,
+    // which reads the whole file; without it a damaged file can make queries read outside of it.
+    explicit snapshot_file(const std::string& path, bool verify = false);
+    ~snapshot_file();
+
+    snapshot_file(const snapshot_file&) = delete;
+    snapshot_file& operator=(const snapshot_file&) = delete;
+
+    const index_view& view() const { return m_view; }
+    std::size_t size() const { return m_size; }
+
+private:
+    void *m_data = nullptr;
+    std::size_t m_size = 0;
+    index_view m_view;
+};
+
+#endif //OS_COURSE_WORK_SNAPSHOT_H
@@ -0,0 +1,219 @@
+#include "statx_ring.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    int io_uring_setup(unsigned entries, io_uring_params* params){
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    int io_uring_register(int fd, unsigned opcode, void* arg, unsigned args){
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, args));
+    }
+
+    // the kernel reads the tails and writes the heads of the rings concurrently
+    unsigned load_acquire(const unsigned* value){
+        return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+    }
+
+    void store_release(unsigned* value, unsigned new_value){
+        __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+    }
+
+    void* map_ring(int fd, std::size_t size, off_t offset){
+        void *ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if(ring == MAP_FAILED){
+            throw std::system_error(errno, std::generic_category(), "io_uring mmap");
+        }
+        return ring;
+    }
+
+    bool probe_statx(int fd){
+        const unsigned ops = IORING_OP_STATX + 1;
+        std::vector<char> buffer(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op), 0);
+        auto *probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if(io_uring_register(fd, IORING_REGISTER_PROBE, probe, ops) < 0){
+            return false;
+        }
+        return probe->ops_len > IORING_OP_STATX && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+}
+
+statx_ring::statx_ring(unsigned entries){
+    io_uring_params params{};
+    m_fd = io_uring_setup(entries, &params);
+    if(m_fd < 0){
+        throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+    }
+    try{
+        if(!probe_statx(m_fd)){
+            throw std::system_error(EOPNOTSUPP, std::generic_category(), "io_uring statx");
+        }
+        m_entries = params.sq_entries;
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        // kernels with a single mmap share one mapping between both rings
+        if(params.features & IORING_FEAT_SINGLE_MMAP){
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        }
+        m_sq_ring = map_ring(m_fd, m_sq_ring_size, IORING_OFF_SQ_RING);
+        m_cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? m_sq_ring
+                                                              : map_ring(m_fd, m_cq_ring_size, IORING_OFF_CQ_RING);
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = map_ring(m_fd, m_sqes_size, IORING_OFF_SQES);
+    } catch (...){
+        release();
+        throw;
+    }
+    auto *sq = static_cast<char*>(m_sq_ring);
+    m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    auto *cq = static_cast<char*>(m_cq_ring);
+    m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = cq + params.cq_off.cqes;
+}
+
+statx_ring::~statx_ring(){
+    release();
+}
+
+void statx_ring::release(){
+    if(m_sqes != nullptr){
+        munmap(m_sqes, m_sqes_size);
+        m_sqes = nullptr;
+    }
+    if(m_cq_ring != nullptr && m_cq_ring != m_sq_ring){
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    m_cq_ring = nullptr;
+    if(m_sq_ring != nullptr){
+        munmap(m_sq_ring, m_sq_ring_size);
+        m_sq_ring = nullptr;
+    }
+    if(m_fd >= 0){
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool statx_ring::supported(){
+    static const bool result = []{
+        try{
+            statx_ring ring(1);
+            return true;
+        } catch (const std::system_error&){
+            return false;
+        }
+    }();
+    return result;
+}
+
+void statx_ring::run(int dir_fd, statx_request* requests, std::size_t count){
+    auto *sqes = static_cast<io_uring_sqe*>(m_sqes);
+    std::size_t queued = 0, completed = 0;
+    unsigned in_flight = 0, unsubmitted = 0;
+    std::uint64_t enters = 0;
+    while(completed < count){
+        // the ring is refilled as soon as requests complete, so it stays full while there is work left
+        unsigned tail = *m_sq_tail;
+        while(queued < count && in_flight < m_entries){
+            const unsigned index = tail & m_sq_mask;
+            io_uring_sqe &sqe = sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_STATX;
+            sqe.fd = dir_fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(requests[queued].m_name);
+            sqe.len = STATX_BASIC_STATS;
+            sqe.off = reinterpret_cast<std::uint64_t>(&requests[queued].m_result);
+            sqe.statx_flags = static_cast<std::uint32_t>(requests[queued].m_flags);
+            sqe.user_data = queued;
+            m_sq_array[index] = index;
+            ++tail;
+            ++queued;
+            ++in_flight;
+            ++unsubmitted;
+        }
+        store_release(m_sq_tail, tail);
+
+        const int submitted = io_uring_enter(m_fd, unsubmitted, 1, IORING_ENTER_GETEVENTS);
+        ++enters;
+        if(submitted < 0){
+            if(errno != EINTR && errno != EAGAIN && errno != EBUSY){
+                const int error = errno;
+                // the kernel has not seen the unsubmitted entries, the submitted ones may still write into `requests`
+                store_release(m_sq_tail, tail - unsubmitted);
+                in_flight -= unsubmitted;
+                enters += reap(requests, in_flight);
+                add_metric(get_metrics().m_io_uring_enters, enters);
+                throw std::system_error(error, std::generic_category(), "io_uring_enter");
+            }
+        } else{
+            unsubmitted -= static_cast<unsigned>(submitted);
+        }
+
+        const unsigned reaped = consume_completions(requests);
+        completed += reaped;
+        in_flight -= reaped;
+    }
+    add_metric(get_metrics().m_io_uring_enters, enters);
+}
+
+unsigned statx_ring::consume_completions(statx_request* requests){
+    const auto *cqes = static_cast<const io_uring_cqe*>(m_cqes);
+    unsigned head = *m_cq_head;
+    const unsigned cq_tail = load_acquire(m_cq_tail);
+    unsigned reaped = 0;
+    for (; head != cq_tail; ++head, ++reaped) {
+        const io_uring_cqe &cqe = cqes[head & m_cq_mask];
+        requests[cqe.user_data].m_error = cqe.res < 0 ? -cqe.res : 0;
+    }
+    store_release(m_cq_head, head);
+    return reaped;
+}
+
+std::uint64_t statx_ring::reap(statx_request* requests, unsigned in_flight){
+    std::uint64_t enters = 0;
+    while(in_flight > 0){
+        // completions are posted without an enter call too, if waiting fails the ring is polled instead
+        if(io_uring_enter(m_fd, 0, in_flight, IORING_ENTER_GETEVENTS) < 0 &&
+           errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            sched_yield();
+        }
+        ++enters;
+        in_flight -= consume_completions(requests);
+    }
+    return enters;
+}
+
+struct stat stat_from_statx(const struct statx& sx){
+    struct stat sb{};
+    sb.st_mode = sx.stx_mode;
+    sb.st_ino = sx.stx_ino;
+    sb.st_nlink = sx.stx_nlink;
+    sb.st_uid = sx.stx_uid;
+    sb.st_gid = sx.stx_gid;
+    sb.st_size = static_cast<off_t>(sx.stx_size);
+    sb.st_blocks = static_cast<blkcnt_t>(sx.stx_blocks);
+    sb.st_mtim.tv_sec = sx.stx_mtime.tv_sec;
+    sb.st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+    return sb;
+}
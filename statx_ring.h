@@ -0,0 +1,68 @@
+#ifndef OS_COURSE_WORK_STATX_RING_H
+#define OS_COURSE_WORK_STATX_RING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/stat.h>
+
+// one statx of a batch, relative to the directory passed to statx_ring::run
+struct statx_request{
+    const char* m_name = nullptr;
+    // AT_SYMLINK_NOFOLLOW or 0
+    int m_flags = 0;
+    struct statx m_result{};
+    // errno of the call, 0 on success
+    int m_error = 0;
+};
+
+// An io_uring with only IORING_OP_STATX requests, one per walker thread.
+// A batch is submitted with as many requests in flight as the ring holds, so on filesystems with
+// a high latency per call (NFS, FUSE) the calls of a directory overlap instead of waiting one by one.
+// Uses the raw syscalls, no liburing.
+class statx_ring{
+public:
+    // throws std::system_error if io_uring can not be set up or does not support statx
+    explicit statx_ring(unsigned entries);
+    ~statx_ring();
+
+    statx_ring(const statx_ring&) = delete;
+    statx_ring& operator=(const statx_ring&) = delete;
+
+    // true if a ring with statx can be set up in this process, checked once
+    static bool supported();
+
+    // Stats every request relative to `dir_fd` and waits for all of them, throws std::system_error if the ring fails.
+    // The requests the kernel was given are completed before it throws, so `requests` can be freed afterwards.
+    void run(int dir_fd, statx_request* requests, std::size_t count);
+
+private:
+    void release();
+    // copies the results of the completed requests, returns how many there were
+    unsigned consume_completions(statx_request* requests);
+    // waits until `in_flight` submitted requests have completed, returns the number of enter calls
+    std::uint64_t reap(statx_request* requests, unsigned in_flight);
+
+    int m_fd = -1;
+    unsigned m_entries = 0;
+    void *m_sq_ring = nullptr;
+    std::size_t m_sq_ring_size = 0;
+    void *m_cq_ring = nullptr;
+    std::size_t m_cq_ring_size = 0;
+    void *m_sqes = nullptr;
+    std::size_t m_sqes_size = 0;
+
+    unsigned *m_sq_head = nullptr;
+    unsigned *m_sq_tail = nullptr;
+    unsigned m_sq_mask = 0;
+    unsigned *m_sq_array = nullptr;
+    unsigned *m_cq_head = nullptr;
+    unsigned *m_cq_tail = nullptr;
+    unsigned m_cq_mask = 0;
+    void *m_cqes = nullptr;
+};
+
+// the fields of struct stat that file records use
+struct stat stat_from_statx(const struct statx& sx);
+
+#endif //OS_COURSE_WORK_STATX_RING_H
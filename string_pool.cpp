@@ -0,0 +1,27 @@
+#include "string_pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const std::size_t first_block_size = 1024;
+static const std::size_t max_block_size = 64 * 1024;
+
+std::string_view string_pool::add(std::string_view text){
+    if(text.empty()){
+        return {};
+    }
+    if(text.size() > m_left){
+        m_block_size = m_block_size == 0 ? first_block_size : std::min(m_block_size * 2, max_block_size);
+        // a string longer than a block gets a block of its own
+        const std::size_t size = std::max(m_block_size, text.size());
+        // not value-initialized, every byte handed out is written first
+        m_blocks.emplace_back(new char[size]);
+        m_next = m_blocks.back().get();
+        m_left = size;
+    }
+    std::memcpy(m_next, text.data(), text.size());
+    const std::string_view copy(m_next, text.size());
+    m_next += text.size();
+    m_left -= text.size();
+    return copy;
+}
@@ -0,0 +1,31 @@
+#ifndef OS_COURSE_WORK_STRING_POOL_H
+#define OS_COURSE_WORK_STRING_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Arena for short strings that live and die together, like the names of one directory's files.
+// Strings are copied into blocks that are never moved or freed before the pool, so the returned views
+// stay valid until the pool is destroyed, moving the pool included.
+// Blocks start small and grow, a pool holding a few names costs one allocation.
+class string_pool{
+public:
+    string_pool() = default;
+
+    string_pool(const string_pool&) = delete;
+    string_pool& operator=(const string_pool&) = delete;
+    string_pool(string_pool&&) = default;
+    string_pool& operator=(string_pool&&) = default;
+
+    std::string_view add(std::string_view text);
+
+private:
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    char *m_next = nullptr;
+    std::size_t m_left = 0;
+    std::size_t m_block_size = 0;
+};
+
+#endif //OS_COURSE_WORK_STRING_POOL_H
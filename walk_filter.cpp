@@ -0,0 +1,141 @@
+#include "walk_filter.h"
+#include "helpers.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+
+#include <fnmatch.h>
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+walk_filter::walk_filter(vector<string> roots): m_roots(std::move(roots)){
+}
+
+bool walk_filter::make_pattern(string text, glob_pattern& pattern){
+    if(text.size() > 1 && text.back() == '/'){
+        pattern.m_directory_only = true;
+        text.pop_back();
+    }
+    // a leading slash anchors the pattern at the root
+    if(!text.empty() && text.front() == '/'){
+        pattern.m_path = true;
+        text.erase(0, 1);
+    }
+    if(text.empty()){
+        return false;
+    }
+    pattern.m_path = pattern.m_path || text.find('/') != string::npos;
+    pattern.m_literal = text.find_first_of("*?[\\") == string::npos;
+    pattern.m_text = std::move(text);
+    return true;
+}
+
+bool walk_filter::add_exclude(const string& pattern){
+    glob_pattern glob;
+    if(!make_pattern(pattern, glob)){
+        return false;
+    }
+    m_excludes.push_back(std::move(glob));
+    return true;
+}
+
+bool walk_filter::add_include(const string& pattern){
+    glob_pattern glob;
+    if(!make_pattern(pattern, glob)){
+        return false;
+    }
+    m_includes.push_back(std::move(glob));
+    return true;
+}
+
+void walk_filter::add_extension(const string& extension){
+    m_extensions.push_back(extension.empty() || extension.front() == '.' ? extension : "." + extension);
+}
+
+void walk_filter::load_ignore_file(const string& path){
+    std::ifstream in(path);
+    if(!in){
+        throw std::runtime_error("cannot read ignore file " + path);
+    }
+    string line;
+    std::size_t line_number = 0;
+    while(std::getline(in, line)){
+        ++line_number;
+        while(!line.empty() && std::isspace(static_cast<unsigned char>(line.back()))){
+            line.pop_back();
+        }
+        if(line.empty() || line.front() == '#'){
+            continue;
+        }
+        const bool added = line.front() == '!' ? add_include(line.substr(1)) : add_exclude(line);
+        if(!added){
+            throw std::runtime_error("invalid pattern in ignore file " + path + " line " + std::to_string(line_number) +
+                                     ": " + line);
+        }
+    }
+}
+
+walk_position walk_filter::locate(const string& path) const{
+    // the innermost root the path is in
+    const string *root = nullptr;
+    for (const auto &candidate : m_roots) {
+        const bool inside = path == candidate || candidate == "/" ||
+                            (path.size() > candidate.size() && path.compare(0, candidate.size(), candidate) == 0 &&
+                             path[candidate.size()] == '/');
+        if(inside && (root == nullptr || candidate.size() > root->size())){
+            root = &candidate;
+        }
+    }
+    const string &base = root != nullptr ? *root : path;
+    walk_position position;
+    position.m_root_prefix = base == "/" ? 1 : base.size() + 1;
+    if(path.size() > position.m_root_prefix){
+        position.m_depth = 1 + static_cast<int>(std::count(path.begin() + static_cast<long>(position.m_root_prefix),
+                                                           path.end(), '/'));
+    }
+    return position;
+}
+
+bool walk_filter::matches(const glob_pattern& pattern, string_view relative_directory, const char* name,
+                          bool directory){
+    if(pattern.m_directory_only && !directory){
+        return false;
+    }
+    if(!pattern.m_path){
+        return pattern.m_literal ? pattern.m_text == name : fnmatch(pattern.m_text.c_str(), name, 0) == 0;
+    }
+    // built once per thread, patterns with a slash are checked for every entry
+    thread_local string path;
+    path.assign(relative_directory.data(), relative_directory.size());
+    if(!path.empty()){
+        path += '/';
+    }
+    path += name;
+    return pattern.m_literal ? pattern.m_text == path : fnmatch(pattern.m_text.c_str(), path.c_str(), FNM_PATHNAME) == 0;
+}
+
+bool walk_filter::matches_any(const vector<glob_pattern>& patterns, string_view relative_directory,
+                              const char* name, bool directory){
+    for (const auto &pattern : patterns) {
+        if(matches(pattern, relative_directory, name, directory)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool walk_filter::excludes(string_view relative_directory, const char* name, bool directory) const{
+    return matches_any(m_excludes, relative_directory, name, directory);
+}
+
+bool walk_filter::selects_file(string_view relative_directory, const char* name) const{
+    if(!m_extensions.empty() &&
+       std::find(m_extensions.begin(), m_extensions.end(), file_extension(name)) == m_extensions.end()){
+        return false;
+    }
+    return m_includes.empty() || matches_any(m_includes, relative_directory, name, false);
+}
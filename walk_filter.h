@@ -0,0 +1,73 @@
+#ifndef OS_COURSE_WORK_WALK_FILTER_H
+#define OS_COURSE_WORK_WALK_FILTER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// where a walked path lies below the roots given on the command line
+struct walk_position{
+    // length of the root's path with the slash after it, the rest of the path is the path below the root
+    std::size_t m_root_prefix = 0;
+    // 0 for the root itself
+    int m_depth = 0;
+};
+
+// Decides which entries a walk skips, before they are opened or stat'ed.
+// Globs are matched with fnmatch(3): a pattern without a slash matches the name of an entry,
+// a pattern with a slash matches the path below the root, a trailing slash limits a pattern to directories.
+// Excluded directories are not walked. Include patterns and extensions select files only,
+// every directory that is not excluded is still walked. An exclude wins over an include.
+class walk_filter{
+public:
+    // paths in patterns and depths are counted from `roots`, a path outside of them is a root itself
+    explicit walk_filter(std::vector<std::string> roots = {});
+
+    // false if the pattern is empty
+    bool add_exclude(const std::string& pattern);
+    bool add_include(const std::string& pattern);
+    // "cpp" and ".cpp" are the same extension
+    void add_extension(const std::string& extension);
+    // One exclude pattern per line, lines starting with `#` are comments, lines starting with `!` are includes.
+    // Throws std::runtime_error if the file can not be read or holds an invalid pattern.
+    void load_ignore_file(const std::string& path);
+    // directories more than `depth` levels below the root are not walked, -1 is unlimited
+    void set_max_depth(int depth){ m_max_depth = depth; }
+    // directories on another filesystem than their parent are not walked
+    void set_one_file_system(bool enabled){ m_one_file_system = enabled; }
+
+    bool one_file_system() const { return m_one_file_system; }
+    walk_position locate(const std::string& path) const;
+    bool descends_to(int depth) const { return m_max_depth < 0 || depth <= m_max_depth; }
+
+    // `relative_directory` is the path of the entry's directory below the root, `name` the entry itself;
+    // with `directory` false patterns for directories only do not match
+    bool excludes(std::string_view relative_directory, const char* name, bool directory) const;
+    bool selects_file(std::string_view relative_directory, const char* name) const;
+
+private:
+    struct glob_pattern{
+        std::string m_text;
+        // matched against the path below the root instead of the name
+        bool m_path = false;
+        bool m_directory_only = false;
+        // no wildcards, compared without fnmatch
+        bool m_literal = false;
+    };
+
+    static bool make_pattern(std::string text, glob_pattern& pattern);
+    static bool matches(const glob_pattern& pattern, std::string_view relative_directory, const char* name,
+                        bool directory);
+    static bool matches_any(const std::vector<glob_pattern>& patterns, std::string_view relative_directory,
+                            const char* name, bool directory);
+
+    std::vector<std::string> m_roots;
+    std::vector<glob_pattern> m_excludes;
+    std::vector<glob_pattern> m_includes;
+    std::vector<std::string> m_extensions;
+    int m_max_depth = -1;
+    bool m_one_file_system = false;
+};
+
+#endif //OS_COURSE_WORK_WALK_FILTER_H
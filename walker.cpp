@@ -0,0 +1,502 @@
+#include "walker.h"
+#include "content_hash.h"
+#include "helpers.h"
+#include "index_state.h"
+#include "metrics.h"
+#include "statx_ring.h"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+
+#include <boost/log/trivial.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::string_view;
+using std::vector;
+
+static const std::size_t getdents_buffer_size = 64 * 1024;
+static const std::chrono::milliseconds idle_wait{10};
+// statx requests in flight per walker thread
+static const unsigned statx_ring_entries = 128;
+// directory fds kept open for queued subdirectories, well below the usual limit of 1024 fds
+static const std::size_t max_shared_directories = 256;
+
+// layout of records returned by getdents64, glibc does not export it
+struct linux_dirent64{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[256];
+};
+
+static bool is_dot_or_dot_dot(const char* name){
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// children of "/" must not start with "//"
+static string child_path(string_view directory, const char* name){
+    string path(directory == "/" ? "" : directory);
+    path += '/';
+    path += name;
+    return path;
+}
+
+file_record make_file_record(const std::shared_ptr<string_pool>& strings, string_view directory, string_view name,
+                             const struct stat& sb){
+    file_record record;
+    record.m_directory = directory;
+    record.m_filename = strings->add(name);
+    record.m_extension = file_extension(record.m_filename);
+    record.m_strings = strings;
+    record.m_size = sb.st_size;
+    record.m_last_changed = sb.st_mtim;
+    return record;
+}
+
+file_record make_file_record(string_view directory, string_view name, const struct stat& sb){
+    auto strings = std::make_shared<string_pool>();
+    return make_file_record(strings, strings->add(directory), name, sb);
+}
+
+record_queue::record_queue(std::size_t max_batches): m_max_batches(max_batches == 0 ? 1 : max_batches){}
+
+void record_queue::push(vector<file_record> batch){
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto has_room = [this]{ return m_batches.size() < m_max_batches || m_closed; };
+    if(!has_room()){
+        metrics_timer timer(get_metrics().m_queue_full_ns);
+        m_not_full.wait(lock, has_room);
+    }
+    m_batches.push_back(std::move(batch));
+    get_metrics().m_queue_batches.store(m_batches.size(), std::memory_order_relaxed);
+    lock.unlock();
+    m_not_empty.notify_one();
+}
+
+bool record_queue::pop(vector<file_record>& batch, std::chrono::milliseconds timeout){
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(!m_not_empty.wait_for(lock, timeout, [this]{ return !m_batches.empty() || m_closed; })){
+        return false;
+    }
+    if(m_batches.empty()){
+        return false;
+    }
+    batch = std::move(m_batches.front());
+    m_batches.pop_front();
+    get_metrics().m_queue_batches.store(m_batches.size(), std::memory_order_relaxed);
+    lock.unlock();
+    m_not_full.notify_one();
+    return true;
+}
+
+void record_queue::close(){
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_not_empty.notify_all();
+    m_not_full.notify_all();
+}
+
+bool record_queue::closed_and_empty(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_closed && m_batches.empty();
+}
+
+parallel_walker::directory_fd::directory_fd(int fd, std::atomic<std::size_t>& open_count)
+        : m_fd(fd), m_open_count(open_count){
+    ++m_open_count;
+}
+
+parallel_walker::directory_fd::~directory_fd(){
+    close(m_fd);
+    --m_open_count;
+}
+
+parallel_walker::parallel_walker(vector<string> roots, unsigned jobs, record_queue& output)
+        : m_roots(std::move(roots)), m_output(output){
+    if(jobs == 0){
+        jobs = 1;
+    }
+    for (unsigned i = 0; i < jobs; ++i) {
+        m_queues.push_back(std::make_unique<worker_queue>());
+    }
+}
+
+parallel_walker::~parallel_walker(){
+    join();
+}
+
+void parallel_walker::enable_hashing(const index_state* known){
+    m_hash = true;
+    m_known = known;
+}
+
+bool parallel_walker::enable_io_uring(){
+    m_io_uring = statx_ring::supported();
+    return m_io_uring;
+}
+
+void parallel_walker::set_filter(walk_filter filter){
+    m_filter = std::move(filter);
+}
+
+void parallel_walker::hash_record(int dir_fd, const char* name, file_record& record) const{
+    if(m_known != nullptr && m_known->copy_known_hash(record)){
+        return;
+    }
+    std::uint64_t hash;
+    struct stat sb;
+    auto &metrics = get_metrics();
+    {
+        metrics_timer timer(metrics.m_hash_ns);
+        if(!hash_file_at(dir_fd, name, UINT64_MAX, hash, sb)){
+            BOOST_LOG_TRIVIAL(debug) << "cannot hash " << record.m_directory << "/" << record.m_filename;
+            return;
+        }
+    }
+    add_metric(metrics.m_hashed_files, 1);
+    add_metric(metrics.m_hashed_bytes, static_cast<std::uint64_t>(sb.st_size));
+    // the hash belongs to the file as it was read
+    record.m_size = sb.st_size;
+    record.m_last_changed = sb.st_mtim;
+    record.m_content_hash = static_cast<long long>(hash);
+    record.m_hashed = true;
+}
+
+void parallel_walker::start(){
+    vector<file_record> root_files;
+    auto strings = std::make_shared<string_pool>();
+    for (const auto &root : m_roots) {
+        walk_root(root, strings, root_files);
+    }
+    if(!root_files.empty()){
+        m_output.push(std::move(root_files));
+    }
+    m_running = m_queues.size();
+    for (unsigned i = 0; i < m_queues.size(); ++i) {
+        m_threads.emplace_back(&parallel_walker::run_worker, this, i);
+    }
+}
+
+void parallel_walker::join(){
+    for (auto &thread : m_threads) {
+        if(thread.joinable()){
+            thread.join();
+        }
+    }
+    m_threads.clear();
+}
+
+void parallel_walker::walk_root(const string& root, const std::shared_ptr<string_pool>& strings,
+                                vector<file_record>& root_files){
+    struct stat sb;
+    add_metric(get_metrics().m_stat_calls, 1);
+    if(stat(root.c_str(), &sb) == -1){
+        add_metric(get_metrics().m_walk_errors, 1);
+        BOOST_LOG_TRIVIAL(error) << "stat call failed on " << root << ": " << strerror(errno);
+        return;
+    }
+    if(S_ISDIR(sb.st_mode)){
+        BOOST_LOG_TRIVIAL(trace) << "got directory: " << root;
+        // a subtree rescanned by watch counts depth and paths from the root it belongs to
+        push_directory(0, {root, nullptr, m_filter.locate(root), sb.st_dev});
+        return;
+    }
+    // single file was passed as a root
+    const auto cxx_path = fs::path(root);
+    root_files.push_back(make_file_record(strings, strings->add(cxx_path.parent_path().string()),
+                                          cxx_path.filename().string(), sb));
+    add_metric(get_metrics().m_files_walked, 1);
+    if(m_hash){
+        hash_record(AT_FDCWD, root.c_str(), root_files.back());
+    }
+}
+
+void parallel_walker::push_directory(unsigned index, queued_directory directory){
+    ++m_pending;
+    {
+        auto &queue = *m_queues[index];
+        std::lock_guard<std::mutex> lock(queue.m_mutex);
+        queue.m_directories.push_back(std::move(directory));
+    }
+    m_idle.notify_one();
+}
+
+bool parallel_walker::take_directory(unsigned index, queued_directory& directory){
+    {
+        auto &own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.m_mutex);
+        if(!own.m_directories.empty()){
+            directory = std::move(own.m_directories.back());
+            own.m_directories.pop_back();
+            return true;
+        }
+    }
+    for (std::size_t i = 1; i < m_queues.size(); ++i) {
+        auto &victim = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.m_mutex);
+        if(!victim.m_directories.empty()){
+            directory = std::move(victim.m_directories.front());
+            victim.m_directories.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void parallel_walker::run_worker(unsigned index){
+    vector<char> buffer(getdents_buffer_size);
+    std::unique_ptr<statx_ring> ring;
+    if(m_io_uring){
+        try{
+            ring = std::make_unique<statx_ring>(statx_ring_entries);
+        } catch (const std::exception& err){
+            BOOST_LOG_TRIVIAL(warning) << "walker thread uses stat calls, cannot set up io_uring: " << err.what();
+        }
+    }
+    queued_directory directory;
+    while(true){
+        if(take_directory(index, directory)){
+            walk_directory(index, directory, buffer, ring);
+            // the parent's fd is not kept open while this worker waits for work
+            directory.m_parent.reset();
+            if(--m_pending == 0){
+                std::lock_guard<std::mutex> lock(m_idle_mutex);
+                m_idle.notify_all();
+            }
+            continue;
+        }
+        if(m_pending == 0){
+            break;
+        }
+        std::unique_lock<std::mutex> lock(m_idle_mutex);
+        m_idle.wait_for(lock, idle_wait);
+    }
+    if(--m_running == 0){
+        m_output.close();
+    }
+}
+
+
+void parallel_walker::push_subdirectory(unsigned index, const open_directory& parent, const char* name,
+                                        walk_counters& counters){
+    const int depth = parent.m_position.m_depth + 1;
+    if(!m_filter.descends_to(depth) || m_filter.excludes(parent.m_relative, name, true)){
+        BOOST_LOG_TRIVIAL(trace) << "skipping directory: " << parent.m_path << "/" << name;
+        ++counters.m_skipped;
+        return;
+    }
+    if(m_filter.one_file_system()){
+        // checked before the directory is opened, an automount point is not triggered
+        struct stat sb;
+        ++counters.m_stat_calls;
+        if(fstatat(parent.m_fd, name, &sb, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT) == 0 && sb.st_dev != parent.m_device){
+            BOOST_LOG_TRIVIAL(debug) << "not crossing into another filesystem: " << parent.m_path << "/" << name;
+            ++counters.m_skipped;
+            return;
+        }
+    }
+    // the parent's fd is shared while few are, so the subdirectory is opened without resolving its whole path
+    auto handle = m_open_directories < max_shared_directories ? parent.m_handle : nullptr;
+    push_directory(index, {child_path(parent.m_path, name), std::move(handle), {parent.m_position.m_root_prefix, depth},
+                           parent.m_device});
+}
+
+void parallel_walker::stat_entry(unsigned index, const open_directory& directory, const char* name,
+                                 unsigned char type, vector<file_record>& files, walk_counters& counters){
+    struct stat sb;
+    if(type == DT_UNKNOWN){
+        ++counters.m_stat_calls;
+        if(fstatat(directory.m_fd, name, &sb, AT_SYMLINK_NOFOLLOW) == -1){
+            ++counters.m_errors;
+            BOOST_LOG_TRIVIAL(error) << "stat call failed on " << directory.m_path << "/" << name << ": " << strerror(errno);
+            return;
+        }
+        if(S_ISDIR(sb.st_mode)){
+            push_subdirectory(index, directory, name, counters);
+            return;
+        }
+        // whether the entry is a file is known only now
+        if(!m_filter.selects_file(directory.m_relative, name)){
+            ++counters.m_skipped;
+            return;
+        }
+    }
+    // like ftw(), symlinks are resolved for files
+    ++counters.m_stat_calls;
+    if(fstatat(directory.m_fd, name, &sb, 0) == -1){
+        ++counters.m_errors;
+        BOOST_LOG_TRIVIAL(error) << "stat call failed on " << directory.m_path << "/" << name << ": " << strerror(errno);
+        return;
+    }
+    add_file(directory, name, sb, files);
+}
+
+void parallel_walker::add_file(const open_directory& directory, const char* name, const struct stat& sb,
+                               vector<file_record>& files) const{
+    if(S_ISDIR(sb.st_mode)){
+        BOOST_LOG_TRIVIAL(trace) << "not following symlink to directory: " << directory.m_path << "/" << name;
+        return;
+    }
+    BOOST_LOG_TRIVIAL(trace) << "got file: " << directory.m_path << "/" << name;
+    files.push_back(make_file_record(directory.m_strings, directory.m_path, name, sb));
+    if(m_hash){
+        hash_record(directory.m_fd, name, files.back());
+    }
+}
+
+void parallel_walker::ring_stat_entries(statx_ring& ring, unsigned index, const open_directory& directory,
+                                        const string& names, const vector<pending_entry>& entries,
+                                        vector<file_record>& files, walk_counters& counters){
+    // entries of an unknown type are checked without following symlinks first, like stat_entry does
+    vector<statx_request> requests(entries.size());
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        requests[i].m_name = names.data() + entries[i].m_name;
+        requests[i].m_flags = entries[i].m_type == DT_UNKNOWN ? AT_SYMLINK_NOFOLLOW : 0;
+    }
+    ring.run(directory.m_fd, requests.data(), requests.size());
+    auto unknown_file_skipped = [&](const statx_request& request){
+        return !m_filter.selects_file(directory.m_relative, request.m_name);
+    };
+    vector<statx_request> links;
+    for (const auto &request : requests) {
+        if(request.m_error == 0 && request.m_flags == AT_SYMLINK_NOFOLLOW && S_ISLNK(request.m_result.stx_mode) &&
+           !unknown_file_skipped(request)){
+            links.emplace_back();
+            links.back().m_name = request.m_name;
+        }
+    }
+    // both passes are done before anything is queued, so a failed ring leaves nothing to undo
+    if(!links.empty()){
+        ring.run(directory.m_fd, links.data(), links.size());
+    }
+    counters.m_stat_calls += requests.size() + links.size();
+
+    auto next_link = links.begin();
+    for (const auto &stated : requests) {
+        const statx_request *request = &stated;
+        if(request->m_error == 0 && request->m_flags == AT_SYMLINK_NOFOLLOW){
+            if(S_ISDIR(request->m_result.stx_mode)){
+                push_subdirectory(index, directory, request->m_name, counters);
+                continue;
+            }
+            if(unknown_file_skipped(*request)){
+                ++counters.m_skipped;
+                continue;
+            }
+            if(S_ISLNK(request->m_result.stx_mode)){
+                request = &*next_link++;
+            }
+        }
+        if(request->m_error != 0){
+            ++counters.m_errors;
+            BOOST_LOG_TRIVIAL(error) << "stat call failed on " << directory.m_path << "/" << request->m_name << ": "
+                                     << strerror(request->m_error);
+            continue;
+        }
+        add_file(directory, request->m_name, stat_from_statx(request->m_result), files);
+    }
+}
+
+void parallel_walker::walk_directory(unsigned index, const queued_directory& queued, vector<char>& buffer,
+                                     std::unique_ptr<statx_ring>& ring){
+    auto &metrics = get_metrics();
+    metrics_timer timer(metrics.m_walk_ns);
+    // counted locally and added once per directory
+    std::uint64_t getdents_calls = 0;
+    walk_counters counters;
+    const string &path = queued.m_path;
+    // d_type said directory, O_NOFOLLOW keeps a symlink swapped in since from being followed
+    int dir_fd = queued.m_parent != nullptr
+                 ? openat(queued.m_parent->get(), path.c_str() + path.rfind('/') + 1,
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+                 : open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd == -1){
+        add_metric(metrics.m_walk_errors, 1);
+        BOOST_LOG_TRIVIAL(error) << "cannot open directory " << path << ": " << strerror(errno);
+        return;
+    }
+    open_directory directory;
+    directory.m_handle = std::make_shared<const directory_fd>(dir_fd, m_open_directories);
+    directory.m_fd = dir_fd;
+    directory.m_position = queued.m_position;
+    directory.m_device = queued.m_device;
+    // the path is copied once, the records of the directory's files share it and keep their names next to it
+    directory.m_strings = std::make_shared<string_pool>();
+    directory.m_path = directory.m_strings->add(path);
+    directory.m_relative = directory.m_path.substr(std::min(queued.m_position.m_root_prefix, path.size()));
+    vector<file_record> files;
+    // with a ring the entries are collected and stat'ed together once the whole directory is read
+    string names;
+    vector<pending_entry> pending;
+    while(true){
+        long read_bytes = syscall(SYS_getdents64, dir_fd, buffer.data(), buffer.size());
+        ++getdents_calls;
+        if(read_bytes == -1){
+            ++counters.m_errors;
+            BOOST_LOG_TRIVIAL(error) << "cannot read directory " << path << ": " << strerror(errno);
+            break;
+        }
+        if(read_bytes == 0){
+            break;
+        }
+        for (long offset = 0; offset < read_bytes;) {
+            const auto *entry = reinterpret_cast<const linux_dirent64*>(buffer.data() + offset);
+            offset += entry->d_reclen;
+            const char *name = entry->d_name;
+            if(is_dot_or_dot_dot(name)){
+                continue;
+            }
+            // directories are queued without a stat call
+            if(entry->d_type == DT_DIR){
+                push_subdirectory(index, directory, name, counters);
+                continue;
+            }
+            // skipped by name before the stat call, entries of an unknown type may still turn out to be directories
+            if(m_filter.excludes(directory.m_relative, name, false) ||
+               (entry->d_type != DT_UNKNOWN && !m_filter.selects_file(directory.m_relative, name))){
+                ++counters.m_skipped;
+                continue;
+            }
+            if(ring){
+                pending.push_back({names.size(), entry->d_type});
+                names.append(name, std::strlen(name) + 1);
+                continue;
+            }
+            stat_entry(index, directory, name, entry->d_type, files, counters);
+        }
+    }
+    if(!pending.empty()){
+        try{
+            ring_stat_entries(*ring, index, directory, names, pending, files, counters);
+        } catch (const std::exception& err){
+            // every request the kernel was given has completed, the ring is dropped and
+            // this directory and the rest of the walk use stat calls
+            BOOST_LOG_TRIVIAL(warning) << "walker thread falls back to stat calls: " << err.what();
+            ring.reset();
+            for (const auto &entry : pending) {
+                stat_entry(index, directory, names.data() + entry.m_name, entry.m_type, files, counters);
+            }
+        }
+    }
+    // closed here unless subdirectories were queued relative to it
+    directory.m_handle.reset();
+    add_metric(metrics.m_directories_walked, 1);
+    add_metric(metrics.m_files_walked, files.size());
+    add_metric(metrics.m_getdents_calls, getdents_calls);
+    add_metric(metrics.m_stat_calls, counters.m_stat_calls);
+    add_metric(metrics.m_walk_errors, counters.m_errors);
+    add_metric(metrics.m_walk_skipped, counters.m_skipped);
+    if(!files.empty()){
+        m_output.push(std::move(files));
+    }
+}
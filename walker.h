@@ -0,0 +1,176 @@
+#ifndef OS_COURSE_WORK_WALKER_H
+#define OS_COURSE_WORK_WALKER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "index_writer.h"
+#include "walk_filter.h"
+
+class index_state;
+class statx_ring;
+
+// Builds a record for file `name` located in `directory`, the name is copied into `strings`.
+// `directory` must be a view into `strings` already, so the records of one directory share it.
+file_record make_file_record(const std::shared_ptr<string_pool>& strings, std::string_view directory,
+                             std::string_view name, const struct stat& sb);
+// builds a record with a pool of its own, for files that come one at a time
+file_record make_file_record(std::string_view directory, std::string_view name, const struct stat& sb);
+
+// Bounded multi-producer single-consumer queue of record batches,
+// walker threads push into it and the single database writer pops from it.
+class record_queue{
+public:
+    explicit record_queue(std::size_t max_batches);
+
+    // blocks while the queue is full
+    void push(std::vector<file_record> batch);
+    // waits up to `timeout` for a batch, returns false on timeout or when the queue is closed and empty
+    bool pop(std::vector<file_record>& batch, std::chrono::milliseconds timeout);
+    void close();
+    bool closed_and_empty();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+    std::deque<std::vector<file_record>> m_batches;
+    std::size_t m_max_batches;
+    bool m_closed = false;
+};
+
+// Walks directory trees on several threads.
+// Every worker owns a deque of directories, it takes work from the back of its own deque
+// and steals from the front of the others' when it runs out.
+// Directories are read with getdents64 and entries are stat'ed with fstatat relative to the directory fd.
+// A subdirectory is opened with openat relative to its parent's fd, so the kernel resolves one component
+// instead of the whole path; the parent's fd stays open until its queued subdirectories are opened.
+// At most max_shared_directories fds are kept open this way, past that subdirectories are opened by path.
+// Entries the filter skips are dropped by name, before they are stat'ed or queued.
+// Files of one directory are pushed to the output queue as one batch.
+class parallel_walker{
+public:
+    parallel_walker(std::vector<std::string> roots, unsigned jobs, record_queue& output);
+    ~parallel_walker();
+
+    parallel_walker(const parallel_walker&) = delete;
+    parallel_walker& operator=(const parallel_walker&) = delete;
+
+    // hashes the content of every file, files unchanged since `known` was loaded keep their hash
+    void enable_hashing(const index_state* known);
+    // Stats the files of a directory through an io_uring per worker, many requests in flight at once.
+    // Returns false and keeps the stat calls if io_uring or its statx is not available.
+    bool enable_io_uring();
+    void set_filter(walk_filter filter);
+
+    void start();
+    // waits for all workers, closes the output queue
+    void join();
+
+private:
+    // A directory fd shared by the directory being read and the subdirectories queued from it,
+    // closed when the last of them is done with it.
+    class directory_fd{
+    public:
+        directory_fd(int fd, std::atomic<std::size_t>& open_count);
+        ~directory_fd();
+
+        directory_fd(const directory_fd&) = delete;
+        directory_fd& operator=(const directory_fd&) = delete;
+
+        int get() const { return m_fd; }
+
+    private:
+        int m_fd;
+        std::atomic<std::size_t>& m_open_count;
+    };
+
+    struct queued_directory{
+        std::string m_path;
+        // the parent the directory is opened relative to, null for roots and when too many fds are open,
+        // then m_path is opened
+        std::shared_ptr<const directory_fd> m_parent;
+        walk_position m_position;
+        // with --one-file-system subdirectories on another device than this are skipped
+        dev_t m_device = 0;
+    };
+
+    struct worker_queue{
+        std::mutex m_mutex;
+        std::deque<queued_directory> m_directories;
+    };
+
+    // the directory being read, what its entries need
+    struct open_directory{
+        int m_fd = -1;
+        std::shared_ptr<const directory_fd> m_handle;
+        // a view into m_strings, the pool the records of the directory are built in
+        std::string_view m_path;
+        // the path below the root, for patterns with a slash
+        std::string_view m_relative;
+        walk_position m_position;
+        dev_t m_device = 0;
+        std::shared_ptr<string_pool> m_strings;
+    };
+
+    // per directory, added to the metrics once the directory is done
+    struct walk_counters{
+        std::uint64_t m_stat_calls = 0;
+        std::uint64_t m_errors = 0;
+        std::uint64_t m_skipped = 0;
+    };
+    // an entry waiting for the ring, the name is an offset into the directory's name buffer
+    struct pending_entry{
+        std::size_t m_name;
+        unsigned char m_type;
+    };
+
+    void run_worker(unsigned index);
+    bool take_directory(unsigned index, queued_directory& directory);
+    void push_directory(unsigned index, queued_directory directory);
+    // queues a subdirectory unless the filter skips it
+    void push_subdirectory(unsigned index, const open_directory& parent, const char* name, walk_counters& counters);
+    void walk_directory(unsigned index, const queued_directory& directory, std::vector<char>& buffer,
+                        std::unique_ptr<statx_ring>& ring);
+    void stat_entry(unsigned index, const open_directory& directory, const char* name, unsigned char type,
+                    std::vector<file_record>& files, walk_counters& counters);
+    void ring_stat_entries(statx_ring& ring, unsigned index, const open_directory& directory, const std::string& names,
+                           const std::vector<pending_entry>& entries, std::vector<file_record>& files,
+                           walk_counters& counters);
+    void add_file(const open_directory& directory, const char* name, const struct stat& sb,
+                  std::vector<file_record>& files) const;
+    void walk_root(const std::string& root, const std::shared_ptr<string_pool>& strings,
+                   std::vector<file_record>& root_files);
+    void hash_record(int dir_fd, const char* name, file_record& record) const;
+
+    std::vector<std::string> m_roots;
+    record_queue& m_output;
+    std::vector<std::unique_ptr<worker_queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    bool m_hash = false;
+    const index_state* m_known = nullptr;
+    bool m_io_uring = false;
+    walk_filter m_filter;
+
+    // directories queued or being read, walk is over when it drops to zero
+    std::atomic<std::size_t> m_pending{0};
+    // the last worker to finish closes the output queue
+    std::atomic<std::size_t> m_running{0};
+    // directory fds open, being read or kept for queued subdirectories
+    std::atomic<std::size_t> m_open_directories{0};
+    std::mutex m_idle_mutex;
+    std::condition_variable m_idle;
+};
+
+#endif //OS_COURSE_WORK_WALKER_H
@@ -0,0 +1,258 @@
+#include "watcher.h"
+#include "helpers.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <boost/log/trivial.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+static const std::size_t inotify_buffer_size = 64 * 1024;
+// IN_MODIFY catches files that are appended to and never closed, the bursts are coalesced anyway
+static const uint32_t directory_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                       IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                       IN_ONLYDIR | IN_DONT_FOLLOW;
+// a root that is a single file is watched itself
+static const uint32_t file_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+
+inotify_watcher::inotify_watcher(vector<string> roots, walk_filter filter)
+        : m_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), m_roots(std::move(roots)), m_filter(std::move(filter)){
+    if(m_fd == -1){
+        throw std::system_error(errno, std::generic_category(), "inotify_init1");
+    }
+}
+
+inotify_watcher::~inotify_watcher(){
+    close(m_fd);
+}
+
+void inotify_watcher::watch_roots(){
+    for (const auto &root : m_roots) {
+        watch_tree(root);
+    }
+    BOOST_LOG_TRIVIAL(debug) << "watching " << m_paths.size() << " paths";
+}
+
+void inotify_watcher::ignore_prefix(string prefix){
+    m_ignored_prefixes.push_back(std::move(prefix));
+}
+
+bool inotify_watcher::is_ignored(const string& path) const{
+    for (const auto &prefix : m_ignored_prefixes) {
+        if(path.compare(0, prefix.size(), prefix) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool inotify_watcher::is_filtered(const string& path, bool directory) const{
+    const auto position = m_filter.locate(path);
+    if(position.m_depth == 0){
+        return false;
+    }
+    const auto slash = path.rfind('/');
+    const string name = path.substr(slash + 1);
+    const auto relative = position.m_root_prefix < slash
+                          ? std::string_view(path).substr(position.m_root_prefix, slash - position.m_root_prefix)
+                          : std::string_view();
+    if(m_filter.excludes(relative, name.c_str(), directory)){
+        return true;
+    }
+    if(!directory){
+        return !m_filter.selects_file(relative, name.c_str());
+    }
+    if(!m_filter.descends_to(position.m_depth)){
+        return true;
+    }
+    if(m_filter.one_file_system()){
+        struct stat sb, parent_sb;
+        const string parent = slash == 0 ? string("/") : path.substr(0, slash);
+        return fstatat(AT_FDCWD, path.c_str(), &sb, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT) == 0 &&
+               stat(parent.c_str(), &parent_sb) == 0 && sb.st_dev != parent_sb.st_dev;
+    }
+    return false;
+}
+
+bool inotify_watcher::add_watch(const string& path, uint32_t mask){
+    int wd = inotify_add_watch(m_fd, path.c_str(), mask);
+    if(wd == -1){
+        if(errno == ENOSPC && !m_watch_limit_reported){
+            BOOST_LOG_TRIVIAL(error) << "inotify watch limit reached, changes under " << path
+                                     << " and further directories are not seen, raise fs.inotify.max_user_watches";
+            m_watch_limit_reported = true;
+        } else if(errno != ENOSPC){
+            BOOST_LOG_TRIVIAL(debug) << "cannot watch " << path << ": " << strerror(errno);
+        }
+        return false;
+    }
+    // the same inode watched again under a new path keeps its descriptor
+    auto it = m_paths.find(wd);
+    if(it != m_paths.end() && it->second != path){
+        m_watches.erase(it->second);
+    }
+    m_paths[wd] = path;
+    m_watches[path] = wd;
+    return true;
+}
+
+void inotify_watcher::watch_tree(const string& root){
+    struct stat sb;
+    if(stat(root.c_str(), &sb) == -1){
+        BOOST_LOG_TRIVIAL(debug) << "cannot watch " << root << ": " << strerror(errno);
+        return;
+    }
+    if(!S_ISDIR(sb.st_mode)){
+        if(add_watch(root, file_mask)){
+            m_file_watches.insert(m_watches[root]);
+        }
+        return;
+    }
+    vector<string> directories{root};
+    while(!directories.empty()){
+        string directory = std::move(directories.back());
+        directories.pop_back();
+        // the watch goes first, entries created while the directory is read are reported
+        if(!add_watch(directory, directory_mask)){
+            continue;
+        }
+        DIR *dir = opendir(directory.c_str());
+        if(dir == nullptr){
+            BOOST_LOG_TRIVIAL(debug) << "cannot open directory " << directory << ": " << strerror(errno);
+            continue;
+        }
+        const string prefix = directory == "/" ? "" : directory;
+        while(const dirent *entry = readdir(dir)){
+            const char *name = entry->d_name;
+            if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))){
+                continue;
+            }
+            bool is_directory = entry->d_type == DT_DIR;
+            if(entry->d_type == DT_UNKNOWN){
+                struct stat entry_sb;
+                is_directory = fstatat(dirfd(dir), name, &entry_sb, AT_SYMLINK_NOFOLLOW) == 0 &&
+                               S_ISDIR(entry_sb.st_mode);
+            }
+            if(is_directory){
+                string path = prefix + "/" + name;
+                if(!is_filtered(path, true)){
+                    directories.push_back(std::move(path));
+                }
+            }
+        }
+        closedir(dir);
+    }
+}
+
+void inotify_watcher::unwatch_tree(const string& root){
+    const auto bounds = subtree_bounds(root);
+    auto it = m_watches.lower_bound(root);
+    const auto last = m_watches.lower_bound(bounds.second);
+    while(it != last){
+        // siblings like "root-1" sort between "root" and "root/"
+        if(it->first != root && it->first < bounds.first){
+            ++it;
+            continue;
+        }
+        inotify_rm_watch(m_fd, it->second);
+        m_paths.erase(it->second);
+        m_file_watches.erase(it->second);
+        it = m_watches.erase(it);
+    }
+}
+
+bool inotify_watcher::wait(std::chrono::milliseconds timeout, watch_changes& changes){
+    pollfd pfd{m_fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, static_cast<int>(timeout.count()));
+    if(ready == -1 && errno != EINTR){
+        BOOST_LOG_TRIVIAL(error) << "poll on inotify descriptor failed: " << strerror(errno);
+    }
+    if(ready <= 0){
+        return false;
+    }
+    alignas(inotify_event) char buffer[inotify_buffer_size];
+    while(true){
+        ssize_t read_bytes = read(m_fd, buffer, sizeof(buffer));
+        if(read_bytes <= 0){
+            if(read_bytes == -1 && errno != EAGAIN && errno != EINTR){
+                BOOST_LOG_TRIVIAL(error) << "cannot read inotify events: " << strerror(errno);
+            }
+            break;
+        }
+        for (ssize_t offset = 0; offset < read_bytes;) {
+            const auto *event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            handle_event(*event, changes);
+        }
+    }
+    return true;
+}
+
+void inotify_watcher::handle_event(const inotify_event& event, watch_changes& changes){
+    if(event.mask & IN_Q_OVERFLOW){
+        BOOST_LOG_TRIVIAL(warning) << "inotify queue overflowed, rescanning all roots";
+        watch_roots();
+        changes.m_subtrees.insert(m_roots.begin(), m_roots.end());
+        return;
+    }
+    auto it = m_paths.find(event.wd);
+    if(it == m_paths.end()){
+        return;
+    }
+    // copied, the maps are changed below
+    const string watched = it->second;
+    if(event.mask & IN_IGNORED){
+        auto watch = m_watches.find(watched);
+        if(watch != m_watches.end() && watch->second == event.wd){
+            m_watches.erase(watch);
+        }
+        m_paths.erase(it);
+        m_file_watches.erase(event.wd);
+        return;
+    }
+
+    if(event.len == 0){
+        // event on the watched path itself, below the roots the parent directory reports it too
+        if(m_file_watches.count(event.wd)){
+            changes.m_files.insert(watched);
+        } else if(event.mask & (IN_DELETE_SELF | IN_MOVE_SELF) &&
+                  std::find(m_roots.begin(), m_roots.end(), watched) != m_roots.end()){
+            BOOST_LOG_TRIVIAL(warning) << "root " << watched << " was moved or deleted, it is no longer watched";
+            unwatch_tree(watched);
+            changes.m_subtrees.insert(watched);
+        }
+        return;
+    }
+
+    string path = watched == "/" ? "/" + string(event.name) : watched + "/" + event.name;
+    if(is_ignored(path)){
+        return;
+    }
+    if(is_filtered(path, (event.mask & IN_ISDIR) != 0)){
+        return;
+    }
+    if(event.mask & IN_ISDIR){
+        if(event.mask & (IN_CREATE | IN_MOVED_TO)){
+            BOOST_LOG_TRIVIAL(trace) << "new directory: " << path;
+            watch_tree(path);
+            changes.m_subtrees.insert(std::move(path));
+        } else if(event.mask & (IN_DELETE | IN_MOVED_FROM)){
+            BOOST_LOG_TRIVIAL(trace) << "directory is gone: " << path;
+            unwatch_tree(path);
+            changes.m_subtrees.insert(std::move(path));
+        }
+        return;
+    }
+    BOOST_LOG_TRIVIAL(trace) << "changed file: " << path;
+    changes.m_files.insert(std::move(path));
+}
@@ -0,0 +1,77 @@
+#ifndef OS_COURSE_WORK_WATCHER_H
+#define OS_COURSE_WORK_WATCHER_H
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/inotify.h>
+
+#include "walk_filter.h"
+
+// paths touched since the changes were last applied
+struct watch_changes{
+    // files are stat'ed again one by one
+    std::set<std::string> m_files;
+    // directories that are walked again, after a new directory, a move or a queue overflow
+    std::set<std::string> m_subtrees;
+
+    bool empty() const { return m_files.empty() && m_subtrees.empty(); }
+    void clear(){
+        m_files.clear();
+        m_subtrees.clear();
+    }
+};
+
+// Keeps an inotify watch on every directory under the roots and turns events into changed paths.
+// Bursts of events are coalesced by the caller, the same path is recorded once however often it changes.
+// New directories are watched as soon as their event is read and are rescanned as a whole,
+// that way files created before the watch was added are not lost.
+// When the kernel queue overflows events are lost, every root is watched and rescanned again.
+// Paths the walker skips by `filter` are neither watched nor reported.
+class inotify_watcher{
+public:
+    // throws std::system_error if inotify is not available
+    explicit inotify_watcher(std::vector<std::string> roots, walk_filter filter = walk_filter());
+    ~inotify_watcher();
+
+    inotify_watcher(const inotify_watcher&) = delete;
+    inotify_watcher& operator=(const inotify_watcher&) = delete;
+
+    // watches every root and every directory below it
+    void watch_roots();
+    // events on files whose path starts with `prefix` are dropped, used for the database file itself
+    void ignore_prefix(std::string prefix);
+    // waits up to `timeout` for events and records them, returns false on timeout or interrupt
+    bool wait(std::chrono::milliseconds timeout, watch_changes& changes);
+
+    std::size_t watch_count() const { return m_paths.size(); }
+
+private:
+    // watches `root` and its subdirectories, symlinks to directories are not followed like in the walker
+    void watch_tree(const std::string& root);
+    bool add_watch(const std::string& path, uint32_t mask);
+    // drops watches of a directory that was moved or deleted
+    void unwatch_tree(const std::string& root);
+    void handle_event(const inotify_event& event, watch_changes& changes);
+    bool is_ignored(const std::string& path) const;
+    // true if the walker with the same filter would skip the path below a root
+    bool is_filtered(const std::string& path, bool directory) const;
+
+    int m_fd;
+    std::vector<std::string> m_roots;
+    walk_filter m_filter;
+    std::vector<std::string> m_ignored_prefixes;
+    std::unordered_map<int, std::string> m_paths;
+    // ordered by path, so the watches of a subtree are one range
+    std::map<std::string, int> m_watches;
+    // watches of roots that are single files
+    std::unordered_set<int> m_file_watches;
+    bool m_watch_limit_reported = false;
+};
+
+#endif //OS_COURSE_WORK_WATCHER_H